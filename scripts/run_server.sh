@@ -0,0 +1,9 @@
+#!/bin/bash
+
+if [ "$1" = "release" ]
+then
+    shift
+    ./build/release/bin/enet-example-server "$@"
+else
+    ./build/debug/bin/enet-example-server "$@"
+fi
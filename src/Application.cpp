@@ -1,14 +1,17 @@
 #include "Application.h"
 
+#include <algorithm>
+#include <array>
 #include <cmath>
 #include <iostream>
 #include <print>
 #include <ranges>
+#include <span>
 
-#include <SFML/Network/Packet.hpp>
 #include <SFML/Window/Keyboard.hpp>
 #include <imgui.h>
 
+#include "InputJitterBuffer.h"
 #include "NetworkMessage.h"
 #include "Util/Util.h"
 
@@ -26,6 +29,8 @@ namespace
                 return "Connecting..";
             case ConnectState::ConnectFailed:
                 return "Connection failed";
+            case ConnectState::ServerFull:
+                return "Server is full";
         }
         return "Unknown";
     }
@@ -34,10 +39,6 @@ namespace
 Application::Application()
 {
     player_texture_.loadFromFile("assets/person.png");
-    for (int i = 0; i < MAX_CLIENTS; i++)
-    {
-        entities_[i].common.transform.size = {24, 48};
-    }
 }
 
 Application::~Application()
@@ -61,7 +62,7 @@ bool Application::init_as_client()
         {
             connect_state_ = ConnectState::Connecting;
 
-            client_ = enet_host_create(nullptr, 1, 2, 0, 0);
+            client_ = enet_host_create(nullptr, 1, CHANNEL_COUNT, 0, 0);
             if (!client_)
             {
                 connect_state_ = ConnectState::ConnectFailed;
@@ -71,10 +72,10 @@ bool Application::init_as_client()
 
             ENetAddress address{};
             enet_address_set_host(&address, "127.0.0.1");
-            address.port = 12345;
+            address.port = DEFAULT_PORT;
 
             // Connect!
-            peer_ = enet_host_connect(client_, &address, 2, 0);
+            peer_ = enet_host_connect(client_, &address, CHANNEL_COUNT, 0);
             if (!peer_)
             {
                 connect_state_ = ConnectState::ConnectFailed;
@@ -135,18 +136,58 @@ void Application::on_update(sf::Time dt)
         {
             case ENET_EVENT_TYPE_RECEIVE:
             {
-                ToClientNetworkMessage incoming_message(event.packet);
+                ToClientMessageReader incoming_message(event.packet);
                 switch (incoming_message.message_type)
                 {
                     case ToClientMessage::ClientInfo:
-                        incoming_message.payload >> player_id_;
+                    {
+                        auto message = incoming_message.read<ClientInfoMessage>();
+                        if (!message)
+                        {
+                            break;
+                        }
+
+                        player_id_ = message->id;
+                        max_clients_ = message->max_clients;
+                        entities_.resize(message->entity_count);
+                        for (size_t i = 0; i < entities_.size(); i++)
+                        {
+                            entities_[i].common.id = static_cast<i16>(i);
+                        }
+                        for (int i = 0; i < max_clients_; i++)
+                        {
+                            entities_[i].common.transform.size = PLAYER_SIZE;
+                        }
+
+                        // Inputs from an earlier connection are never going to be simulated
+                        pending_inputs_.clear();
+                        unsent_inputs_ = 0;
+
+                        position_quantizer_ =
+                            PositionQuantizer(std::max(message->map_width, message->map_height));
+                    }
+                    break;
+
+                    case ToClientMessage::MapManifest:
+                    {
+                        auto request = map_receiver_.read_manifest(incoming_message);
+                        if (request && *request)
+                        {
+                            enet_peer_send(peer_, CHANNEL_MAP, *request);
+                        }
+                    }
+                    break;
+
+                    case ToClientMessage::MapChunk:
+                        map_receiver_.read_chunk(incoming_message);
                         break;
 
                     case ToClientMessage::Message:
                     {
-                        std::string message;
-                        incoming_message.payload >> message;
-                        std::println("[Client]  Got message from server: {}", message);
+                        if (auto message = incoming_message.read<ToClientChatMessage>())
+                        {
+                            std::println("[Client]  Got message from server: {}", message->text);
+                        }
                     }
                     break;
 
@@ -158,67 +199,44 @@ void Application::on_update(sf::Time dt)
                         std::println("[Client] A player has left.\n");
                         break;
 
-                    // Snapshot contains the positons of ALL entities - including the player's own
+                    // Snapshot contains the changes to the entities since the last snapshot this
+                    // client acknowledged. These are sent unreliably on their own channel, and
+                    // split over several packets that are each applied as soon as they arrive
                     case ToClientMessage::Snapshot:
                     {
-                        // In this example, the server and client should have matching arrays that
-                        // align with what is in the packet
-                        for (auto& entity : entities_)
+                        // The snapshot channel is not ordered with ClientInfo. Until that has
+                        // arrived the map size, and so the bit width of the positions, is unknown.
+                        // The snapshot is not acknowledged, so the next one is sent in full
+                        if (static_cast<size_t>(player_id_) >= entities_.size())
                         {
-                            // Read state from the packet - TODO seperate this logic out from the
-                            // looping of players
-                            sf::Vector2f position;
-                            u32 input_sequence = 0;
-                            incoming_message.payload >> entity.common.id >> input_sequence >>
-                                position.x >> position.y >> entity.common.active;
-
-                            // If the entity is "this player"
-                            if (entity.common.id == player_id_)
-                            {
-                                auto& player_transform =
-                                    entities_[(size_t)player_id_].common.transform;
+                            break;
+                        }
 
-                                // Set position
-                                player_transform.position = position;
+                        auto result =
+                            snapshot_receiver_.read_part(incoming_message, position_quantizer_);
+                        const auto& snapshot = snapshot_receiver_.snapshot();
+                        if (result == SnapshotPartResult::Dropped ||
+                            snapshot.entities.size() != entities_.size())
+                        {
+                            break;
+                        }
+                        interpolation_delay_.on_snapshot(snapshot.sequence,
+                                                         game_time_.getElapsedTime());
 
-                                // Correct position hen the server is out of sync with this client
-                                if (config_.server_reconciliation_)
-                                {
-                                    std::erase_if(
-                                        pending_inputs_, [input_sequence](const auto& pending)
-                                        { return pending.input.sequence <= input_sequence; });
-                                    bool out_of_sync_found = false;
-                                    for (const auto& pending_input : pending_inputs_)
-                                    {
-                                        if (pending_input.input.sequence > input_sequence)
-                                        {
-                                            // When an out-of-sync input is found, the player state
-                                            // is reset back to that to ensure the final result is
-                                            // identical after re-applping the inputs
-                                            if (!out_of_sync_found)
-                                            {
-                                                player_transform = pending_input.state;
-                                                out_of_sync_found = true;
-                                            }
-                                            process_input_for_player(player_transform,
-                                                                     pending_input.input);
-                                            apply_map_collisions(player_transform);
-
-                                        }
-                                    }
-                                }
-                            }
-                            else if (entity.common.active)
+                        for (auto id : snapshot_receiver_.updated_entities())
+                        {
+                            apply_entity_snapshot(id, snapshot.entities[id]);
+                        }
+
+                        // The entities that did not change since the baseline are only applied
+                        // once the whole snapshot is known to be correct
+                        if (result == SnapshotPartResult::Completed)
+                        {
+                            for (u16 id = 0; id < snapshot.entities.size(); id++)
                             {
-                                if (config_.do_interpolation)
-                                {
-                                    entity.position_buffer.push_back(
-                                        {.timestamp = game_time_.getElapsedTime(),
-                                         .position = position});
-                                }
-                                else
+                                if (!snapshot_receiver_.was_updated(id))
                                 {
-                                    entity.common.transform.position = position;
+                                    apply_entity_snapshot(id, snapshot.entities[id]);
                                 }
                             }
                         }
@@ -232,13 +250,35 @@ void Application::on_update(sf::Time dt)
             }
             break;
 
+            case ENET_EVENT_TYPE_DISCONNECT:
+            case ENET_EVENT_TYPE_DISCONNECT_TIMEOUT:
+            {
+                auto reason = static_cast<DisconnectReason>(event.data);
+                std::println("[Client] Disconnected from the server.");
+                connect_state_ = reason == DisconnectReason::ServerFull
+                                     ? ConnectState::ServerFull
+                                     : ConnectState::Disconnected;
+                peer_ = nullptr;
+                return;
+            }
+
             default:
                 break;
         }
     }
 
-    // Process the inputs, storing the key presses into an object to be sent to the server
-    Input inputs{.sequence = input_sequence_++, .dt = dt.asSeconds()};
+    // Nothing to simulate until the server has sent this client its id
+    if (static_cast<size_t>(player_id_) >= entities_.size())
+    {
+        return;
+    }
+
+    // Process the inputs, storing the key presses into an object to be sent to the server. The
+    // server drops inputs with longer frame times, so a hitch is predicted as the longest it takes
+    // rather than the client moving somewhere the server never simulates
+    auto input_dt = std::min(dt.asSeconds(), MAX_INPUT_DT);
+    Input inputs{.sequence = input_sequence_++,
+                 .dt = dequantize_input_dt(quantize_input_dt(input_dt))};
     if (keyboard_.is_key_down(sf::Keyboard::Key::W))
     {
         inputs.keys |= InputKeyPress::W;
@@ -256,14 +296,27 @@ void Application::on_update(sf::Time dt)
         inputs.keys |= InputKeyPress::D;
     }
 
-    // Send the input packet to the server
-    ToServerNetworkMessage input_message(ToServerMessageType::Input);
-    input_message.payload << inputs.sequence << inputs.dt << inputs.keys;
-    enet_peer_send(peer_, 0, input_message.to_enet_packet());
-
     auto& player_transform = entities_[(size_t)player_id_].common.transform;
 
     pending_inputs_.push_back({inputs, player_transform});
+    unsent_inputs_++;
+
+    // The inputs of each frame are batched up and sent together at the send rate, rather than a
+    // packet each frame. A long frame does not lead to a burst of sends to catch up. They are sent
+    // early once they fill a message, as a low send rate and a high frame rate would otherwise
+    // leave inputs that never fit in one
+    auto send_period = sf::seconds(1.0f / std::max(config_.input_send_rate, 1.0f));
+    input_send_time_ += dt;
+    if (input_send_time_ >= send_period)
+    {
+        input_send_time_ = std::min(input_send_time_ - send_period, send_period);
+        send_inputs();
+    }
+    else if (unsent_inputs_ >= MAX_INPUTS_PER_MESSAGE)
+    {
+        input_send_time_ = sf::Time::Zero;
+        send_inputs();
+    }
 
     // Client side prediction ensures the player sees smooth movement despite the real
     // simulation being om the server
@@ -272,109 +325,112 @@ void Application::on_update(sf::Time dt)
     if (config_.client_side_prediction_)
     {
         process_input_for_player(player_transform, inputs);
-        apply_map_collisions(player_transform);
+        apply_map_collisions(player_transform, map_receiver_.map());
     }
 
-    // Deubgging t
-    static std::vector<float> rts;
-    static std::vector<float> ts;
-    static std::vector<float> t0s;
-    static std::vector<float> t1s;
-
     if (config_.do_interpolation)
     {
-        auto now = game_time_.getElapsedTime();
-        auto render_ts = (now - sf::milliseconds(1000.0f / (float)SERVER_TPS) * 4.0f);
+        // Entities are shown where they were a little in the past, between the two snapshots either
+        // side of that time. How far back depends on how regularly the snapshots are arriving
+        interpolation_delay_.update(dt);
+        auto render_time = game_time_.getElapsedTime() - interpolation_delay_.delay();
         for (auto& entity : entities_)
         {
-            if (!entity.common.active || entity.position_buffer.size() < 2 ||
-                player_id_ == entity.common.id)
+            if (!entity.common.active || player_id_ == entity.common.id)
             {
                 continue;
             }
-            auto& buffer = entity.position_buffer;
-
-            while (buffer.size() > 2 && buffer[1].timestamp <= render_ts)
+            if (auto position = entity.position_buffer.sample(render_time))
             {
-                buffer.erase(buffer.begin());
+                entity.common.transform.position = *position;
             }
+        }
+    }
+}
 
-            const auto t0 = buffer[0].timestamp;
-            const auto t1 = buffer[1].timestamp;
+void Application::send_inputs()
+{
+    // Every input the server has not yet simulated is sent again, so losing a packet costs nothing
+    // as long as the next one gets through. When there are more than fit, the oldest are sent, as
+    // the server simulates them in order and only holds a message's worth ahead of the next one
+    std::array<Input, MAX_INPUTS_PER_MESSAGE> unacked_inputs;
+    auto unacked_count = std::min(pending_inputs_.size(), unacked_inputs.size());
+    unsent_inputs_ = 0;
+    if (unacked_count == 0)
+    {
+        return;
+    }
+    for (size_t i = 0; i < unacked_count; i++)
+    {
+        unacked_inputs[i] = pending_inputs_[i].input;
+    }
+    if (auto packet = write_input_message({unacked_inputs.data(), unacked_count},
+                                          snapshot_receiver_.latest_complete()))
+    {
+        enet_peer_send(peer_, CHANNEL_INPUT, packet);
+    }
+}
 
-            if (t0 <= render_ts && render_ts <= t1)
-            {
-                const auto& p0 = buffer[0].position;
-                const auto& p1 = buffer[1].position;
+void Application::apply_entity_snapshot(u16 id, const EntitySnapshot& state)
+{
+    // In this example, the server and client have matching arrays, so the index of an entity in the
+    // snapshot is its id
+    auto& entity = entities_[id];
+    const auto& position = state.position;
+    const auto input_sequence = state.last_processed;
+
+    // Entities that were out of the area of interest (or not yet connected) appear where they are
+    // rather than interpolating from where they were last seen
+    if (state.active && !entity.common.active)
+    {
+        entity.position_buffer.clear();
+        entity.common.transform.position = position;
+    }
+    entity.common.active = state.active;
 
-                auto t = ((render_ts - t0) / (t1 - t0));
-                float nx = std::lerp(p0.x, p1.x, t);
-                float ny = std::lerp(p0.y, p1.y, t);
+    // If the entity is "this player"
+    if (entity.common.id == player_id_)
+    {
+        auto& player_transform = entities_[(size_t)player_id_].common.transform;
 
-                // Debug t
-                ts.push_back(t);
-                t0s.push_back(t0.asSeconds());
-                t1s.push_back(t1.asSeconds());
-                rts.push_back(render_ts.asSeconds());
+        // Set position
+        player_transform.position = position;
 
-                entity.common.transform.position = {nx, ny};
-            }
-        }
-        /*
-        while (ts.size() > 10)
-        {
-            ts.erase(ts.begin());
-        }
-        while (rts.size() > 10)
-        {
-            rts.erase(rts.begin());
-        }
-        while (t0s.size() > 10)
-        {
-            t0s.erase(t0s.begin());
-        }
-        while (t1s.size() > 10)
-        {
-            t1s.erase(t1s.begin());
-        }
+        // The server has simulated these, so they no longer need to be sent
+        std::erase_if(pending_inputs_, [input_sequence](const auto& pending)
+                      { return pending.input.sequence <= input_sequence; });
 
-        if (ImGui::Begin("Times."))
+        // Correct position hen the server is out of sync with this client
+        if (config_.server_reconciliation_)
         {
-            if (ImGui::BeginTable("split", 4))
+            bool out_of_sync_found = false;
+            for (const auto& pending_input : pending_inputs_)
             {
-                ImGui::TableNextColumn();
-                ImGui::Text("T");
-                for (auto t : ts)
-                {
-                    ImGui::Text("%f", t);
-                }
-
-                ImGui::TableNextColumn();
-                ImGui::Text("T0");
-                for (auto t : t0s)
+                if (pending_input.input.sequence > input_sequence)
                 {
-                    ImGui::Text("%f", t);
-                }
-
-                ImGui::TableNextColumn();
-                ImGui::Text("T1");
-                for (auto t : t1s)
-                {
-                    ImGui::Text("%f", t);
-                }
-
-                ImGui::TableNextColumn();
-                ImGui::Text("Render Timestamp");
-                for (auto t : rts)
-                {
-                    ImGui::Text("%f", t);
+                    // When an out-of-sync input is found, the player state is reset back to
+                    // that to ensure the final result is identical after re-applping the inputs
+                    if (!out_of_sync_found)
+                    {
+                        player_transform = pending_input.state;
+                        out_of_sync_found = true;
+                    }
+                    process_input_for_player(player_transform, pending_input.input);
+                    apply_map_collisions(player_transform, map_receiver_.map());
                 }
-
-                ImGui::EndTable();
             }
         }
-        ImGui::End();
-    */
+    }
+    else if (entity.common.active)
+    {
+        if (config_.do_interpolation)
+        {
+            entity.position_buffer.push(game_time_.getElapsedTime(), position);
+        }
+        else
+        {
+            entity.common.transform.position = position;
+        }
     }
 }
 
@@ -391,10 +447,11 @@ void Application::on_render(sf::RenderWindow& window)
 
             if (ImGui::Button("Send something"))
             {
-                ToServerNetworkMessage outgoing_message{ToServerMessageType::Message};
-                outgoing_message.payload << std::string{message};
-                enet_peer_send(peer_, 0, outgoing_message.to_enet_packet());
-                enet_host_flush(client_);
+                if (auto packet = to_enet_packet(ToServerChatMessage{.text = message}))
+                {
+                    enet_peer_send(peer_, CHANNEL_RELIABLE, packet);
+                    enet_host_flush(client_);
+                }
             }
 
             ImGui::Separator();
@@ -402,6 +459,14 @@ void Application::on_render(sf::RenderWindow& window)
             ImGui::Checkbox("Interpolation: ", &config_.do_interpolation);
             ImGui::Checkbox("Client Side Prediction: ", &config_.client_side_prediction_);
             ImGui::Checkbox("Server Reconciliation: ", &config_.server_reconciliation_);
+            ImGui::SliderFloat("Input Send Rate: ", &config_.input_send_rate, 1, 144);
+            ImGui::Text("Interpolation delay: %.0fms (target %.0fms)",
+                        interpolation_delay_.delay().asSeconds() * 1000,
+                        interpolation_delay_.target().asSeconds() * 1000);
+            ImGui::Text("Snapshot interval: %.1fms, jitter: %.1fms, loss: %.1f%%",
+                        interpolation_delay_.interval().asSeconds() * 1000,
+                        interpolation_delay_.jitter().asSeconds() * 1000,
+                        interpolation_delay_.loss() * 100);
         }
     }
     ImGui::End();
@@ -411,62 +476,67 @@ void Application::on_render(sf::RenderWindow& window)
         return;
     }
 
-    // Draw tiles
-    sprite_.setTexture(nullptr);
-    sprite_.setOutlineThickness(1);
-    sprite_.setSize({TILE_SIZE, TILE_SIZE});
-    for (int y = 0; y < MAP_SIZE; y++)
+    // The camera is centred on this player, and is the size of the window so nothing is stretched
+    camera_.setSize(sf::Vector2f(window.getSize()));
+    if (static_cast<size_t>(player_id_) < entities_.size())
     {
-        for (int x = 0; x < MAP_SIZE; x++)
-        {
-            auto tile = get_tile(x, y);
-            if (tile > 0)
-            {
-                if (tile == 1)
-                {
-                    sprite_.setFillColor(sf::Color::Green);
-                }
-                sprite_.setPosition({x * TILE_SIZE, y * TILE_SIZE});
-                window.draw(sprite_);
-            }
-        }
+        const auto& transform = entities_[(size_t)player_id_].common.transform;
+        camera_.setCenter(transform.position + transform.size / 2.0f);
     }
-    sprite_.setOutlineThickness(0);
+    window.setView(camera_);
 
-    // Draw entities
-    sprite_.setFillColor({255, 255, 150, 100});
-    for (auto& e : entities_ | std::ranges::views::drop(MAX_CLIENTS))
+    // Draw tiles, which only builds and draws the chunks in view
+    map_renderer_.invalidate(map_receiver_.take_changed_chunks());
+    map_renderer_.draw(window, map_receiver_.map());
+
+    // Entities outside of the area of interest are drawn too, as long as they are in view. Checking
+    // each one is a few compares, far less than bucketing them all by position every frame
+    auto view_min = camera_.getCenter() - camera_.getSize() / 2.0f;
+    auto view_max = camera_.getCenter() + camera_.getSize() / 2.0f;
+    auto is_visible = [&](const EntityCommon& e)
     {
-        sprite_.setSize(e.common.transform.size);
-        sprite_.setPosition(e.common.transform.position);
-        window.draw(sprite_);
-    }
+        const auto& position = e.transform.position;
+        const auto& size = e.transform.size;
+        return e.active && position.x < view_max.x && position.y < view_max.y &&
+               position.x + size.x > view_min.x && position.y + size.y > view_min.y;
+    };
+
+    // Drawn in order of id so entities overlap in the same order each frame. The players are the
+    // lowest ids, and are drawn after the NPCs so they are on top
+    auto player_count = std::min(entities_.size(), static_cast<size_t>(max_clients_));
+    auto players = std::span(entities_).first(player_count);
+    auto npcs = std::span(entities_).subspan(player_count);
 
-    // Draw players
-    sprite_.setSize(entities_[0].common.transform.size);
-    sprite_.setTexture(&player_texture_);
-    for (int i = 0; i < MAX_CLIENTS; i++)
+    // Draw entities
+    npc_vertices_.clear();
+    for (const auto& npc : npcs)
     {
-        auto& e = entities_[i].common;
-        if (!e.active)
+        if (!is_visible(npc.common))
         {
             continue;
         }
+        const auto& transform = npc.common.transform;
+        append_quad(npc_vertices_, transform.position, transform.size, {255, 255, 150, 100});
+    }
+    window.draw(npc_vertices_);
 
-        if (e.id == player_id_)
-        {
-            sprite_.setFillColor(sf::Color::White);
-        }
-        else if (e.active)
+    // Draw players, which all share the one texture so are drawn in a single call as well
+    player_vertices_.clear();
+    sf::FloatRect player_texture_rect{{0, 0}, sf::Vector2f(player_texture_.getSize())};
+    for (const auto& player : players)
+    {
+        const auto& e = player.common;
+        if (!is_visible(e))
         {
-            sprite_.setFillColor({100, 255, 255, 100});
+            continue;
         }
-        sprite_.setPosition(e.transform.position);
-        window.draw(sprite_);
+        auto colour = e.id == player_id_ ? sf::Color::White : sf::Color{100, 255, 255, 100};
+        append_quad(player_vertices_, e.transform.position, e.transform.size, colour,
+                    player_texture_rect);
     }
-    sprite_.setTexture(nullptr);
-
+    window.draw(player_vertices_, &player_texture_);
 
+    window.setView(window.getDefaultView());
 }
 
 void Application::disconnect()
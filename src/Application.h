@@ -1,31 +1,39 @@
 #pragma once
 
-#include <SFML/Graphics/RectangleShape.hpp>
 #include <SFML/Graphics/RenderWindow.hpp>
 #include <SFML/Graphics/Texture.hpp>
+#include <SFML/Graphics/VertexArray.hpp>
+#include <SFML/Graphics/View.hpp>
 #include <SFML/System/Clock.hpp>
 
 #include "Common.h"
+#include "Interpolation.h"
+#include "MapRenderer.h"
+#include "MapStream.h"
+#include "Snapshot.h"
 #include "Util/Keyboard.h"
 #include "Server.h"
 
+/// Inputs sent to the server each second by default. Inputs are sampled every frame, but sent in
+/// batches as the server only simulates them once per tick
+constexpr float DEFAULT_INPUT_SEND_RATE = SERVER_TICK_RATE;
+
+/// Where the chunks of maps streamed from servers are kept between runs
+constexpr auto MAP_CACHE_FILE = "map_cache.bin";
+
 enum class ConnectState
 {
     Disconnected,
     Connecting,
     Connected,
     ConnectFailed,
+    ServerFull,
 };
 
 struct Entity
 {
     /// The position buffer is used for client side interpolation
-    struct PositionBuffer
-    {
-        sf::Time timestamp;
-        sf::Vector2f position;
-    };
-    std::vector<PositionBuffer> position_buffer;
+    PositionHistory position_buffer;
 
     /// Transforms, id, etc
     EntityCommon common;
@@ -57,6 +65,13 @@ class Application
     void disconnect();
 
   private:
+    /// Applies the state of an entity from a snapshot - including prediction reconciliation when it
+    /// is this player
+    void apply_entity_snapshot(u16 id, const EntitySnapshot& state);
+
+    /// Sends the server the inputs it has not yet simulated
+    void send_inputs();
+
     /// If this client is the host, then the server is created on a different thread
     Server server_;
 
@@ -68,19 +83,48 @@ class Application
     std::atomic<ConnectState> connect_state_ = ConnectState::Disconnected;
     std::jthread connect_thread_;
 
-    /// Used to render all players and entities
-    sf::RectangleShape sprite_;
+    /// The quads of the NPCs and players, rebuilt each frame so each group is drawn in one call.
+    /// They are cleared rather than recreated, so they only allocate when there are more entities
+    sf::VertexArray npc_vertices_{sf::PrimitiveType::Triangles};
+    sf::VertexArray player_vertices_{sf::PrimitiveType::Triangles};
+
+    /// Follows this player, so the world can be larger than the window
+    sf::View camera_;
 
     /// The client Id of this player - used to index the `entities_` array
     i16 player_id_ = 0;
 
+    /// The first `max_clients_` entities are players, sent by the server on connect
+    int max_clients_ = 0;
+
     /// All entities
-    std::vector<Entity> entities_{MAX_ENTITIES};
+    std::vector<Entity> entities_;
+
+    /// The map of the server, streamed in on connect. Used to predict the movement of this player.
+    /// Keeps the chunks it has seen across connections
+    MapReceiver map_receiver_{MAP_CACHE_FILE};
+
+    /// Draws the tiles of the map, rebuilding the chunks that arrive from the server
+    MapRenderer map_renderer_;
+
+    /// Set from the size of the server's map on connect
+    PositionQuantizer position_quantizer_;
+
+    /// Rebuilds the delta snapshots. The latest complete one is acknowledged to the server with
+    /// each input
+    SnapshotReceiver snapshot_receiver_;
+
+    /// How far behind the latest snapshot entities are rendered, adapted to the connection
+    InterpolationDelay interpolation_delay_{1.0f / SERVER_TICK_RATE};
 
     /// Used
     u32 input_sequence_ = 0;
     std::vector<InputBuffer> pending_inputs_;
 
+    /// Time since the inputs were last sent, and how many have been added since
+    sf::Time input_send_time_;
+    size_t unsent_inputs_ = 0;
+
     sf::Texture player_texture_;
 
 
@@ -91,6 +135,9 @@ class Application
         bool do_interpolation = true;
         bool client_side_prediction_ = true;
         bool server_reconciliation_ = true;
+
+        /// Input packets sent to the server each second, independent of the frame rate
+        float input_send_rate = DEFAULT_INPUT_SEND_RATE;
     } config_;
 
     sf::Clock game_time_;
@@ -0,0 +1,279 @@
+#include "CollisionMap.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+    /// The chunks are stored in the file as they are in memory
+    static_assert(std::endian::native == std::endian::little);
+
+    constexpr std::array<char, 4> MAP_FILE_MAGIC = {'E', 'M', 'A', 'P'};
+    /// Version 2 added the chunk hashes after the chunks
+    constexpr u32 MAP_FILE_VERSION = 2;
+
+    /// Padded to 64 bytes, so the chunks after it are aligned to a cache line
+    struct MapFileHeader
+    {
+        std::array<char, 4> magic = MAP_FILE_MAGIC;
+        u32 version = MAP_FILE_VERSION;
+        u32 width = 0;
+        u32 height = 0;
+        u32 chunk_size = MAP_CHUNK_SIZE;
+        std::array<u32, 11> reserved{};
+    };
+    static_assert(sizeof(MapFileHeader) == 64);
+
+    /// Bits `first` to `last` (inclusive) set
+    u64 bit_range(int first, int last)
+    {
+        return (~u64{0} >> (MAP_CHUNK_SIZE - 1 - last)) & (~u64{0} << first);
+    }
+
+    int chunks_for_tiles(int tiles)
+    {
+        return (tiles + MAP_CHUNK_SIZE - 1) / MAP_CHUNK_SIZE;
+    }
+} // namespace
+
+void MapChunk::fill_columns()
+{
+    columns = {};
+    for (int y = 0; y < MAP_CHUNK_SIZE; y++)
+    {
+        for (auto bits = rows[y]; bits != 0; bits &= bits - 1)
+        {
+            columns[std::countr_zero(bits)] |= u64{1} << y;
+        }
+    }
+}
+
+u64 MapChunk::hash() const
+{
+    // FNV-1a over the rows, the columns hold the same tiles
+    u64 hash = 14695981039346656037ull;
+    for (auto row : rows)
+    {
+        for (int byte = 0; byte < 8; byte++)
+        {
+            hash ^= (row >> (byte * 8)) & 0xFF;
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+CollisionMap::CollisionMap(int width, int height)
+    : width_(std::clamp(width, 0, MAX_MAP_TILES))
+    , height_(std::clamp(height, 0, MAX_MAP_TILES))
+    , chunks_x_(chunks_for_tiles(width_))
+    , owned_chunks_(chunks_x_ * chunks_for_tiles(height_))
+{
+    chunks_ = owned_chunks_;
+}
+
+std::optional<CollisionMap> CollisionMap::load(const std::string& path)
+{
+    auto file = MappedFile::open(path);
+    if (!file || file->data().size() < sizeof(MapFileHeader))
+    {
+        return std::nullopt;
+    }
+
+    // Only the header is checked, the chunks are left on disk until they are used
+    MapFileHeader header;
+    std::memcpy(&header, file->data().data(), sizeof(header));
+    if (header.magic != MAP_FILE_MAGIC || header.version != MAP_FILE_VERSION ||
+        header.chunk_size != MAP_CHUNK_SIZE || header.width == 0 || header.height == 0 ||
+        header.width > MAX_MAP_TILES || header.height > MAX_MAP_TILES)
+    {
+        return std::nullopt;
+    }
+
+    CollisionMap map;
+    map.width_ = static_cast<int>(header.width);
+    map.height_ = static_cast<int>(header.height);
+    map.chunks_x_ = chunks_for_tiles(map.width_);
+
+    auto count = static_cast<size_t>(map.chunks_x_) * chunks_for_tiles(map.height_);
+    auto hashes_offset = sizeof(MapFileHeader) + count * sizeof(MapChunk);
+    if (file->data().size() != hashes_offset + count * sizeof(u64))
+    {
+        return std::nullopt;
+    }
+
+    map.chunks_ = {reinterpret_cast<const MapChunk*>(file->data().data() + sizeof(MapFileHeader)),
+                   count};
+    map.file_hashes_ = {reinterpret_cast<const u64*>(file->data().data() + hashes_offset), count};
+    map.file_ = std::move(*file);
+    return map;
+}
+
+bool CollisionMap::save(const std::string& path) const
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+
+    MapFileHeader header{.width = static_cast<u32>(width_), .height = static_cast<u32>(height_)};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(chunks_.data()),
+               static_cast<std::streamsize>(chunks_.size_bytes()));
+    auto hashes = chunk_hashes();
+    file.write(reinterpret_cast<const char*>(hashes.data()),
+               static_cast<std::streamsize>(hashes.size() * sizeof(u64)));
+    return static_cast<bool>(file);
+}
+
+void CollisionMap::set_solid(int x, int y, bool solid)
+{
+    assert(!file_.data().data() && "Maps loaded from a file can not be changed");
+    if (x < 0 || x >= width_ || y < 0 || y >= height_)
+    {
+        return;
+    }
+
+    auto& tiles = owned_chunks_[(y / MAP_CHUNK_SIZE) * chunks_x_ + x / MAP_CHUNK_SIZE];
+    auto local_x = x % MAP_CHUNK_SIZE;
+    auto local_y = y % MAP_CHUNK_SIZE;
+    if (solid)
+    {
+        tiles.rows[local_y] |= u64{1} << local_x;
+        tiles.columns[local_x] |= u64{1} << local_y;
+    }
+    else
+    {
+        tiles.rows[local_y] &= ~(u64{1} << local_x);
+        tiles.columns[local_x] &= ~(u64{1} << local_y);
+    }
+}
+
+void CollisionMap::set_chunk(int index, const MapChunk& tiles)
+{
+    assert(!file_.data().data() && "Maps loaded from a file can not be changed");
+    if (index < 0 || index >= chunk_count())
+    {
+        return;
+    }
+    owned_chunks_[index] = tiles;
+}
+
+bool CollisionMap::is_solid(int x, int y) const
+{
+    return any_solid_in_row(y, x, x);
+}
+
+bool CollisionMap::any_solid_in_row(int y, int x_begin, int x_end) const
+{
+    x_begin = std::max(x_begin, 0);
+    x_end = std::min(x_end, width_ - 1);
+    if (y < 0 || y >= height_ || x_begin > x_end)
+    {
+        return false;
+    }
+
+    // An entity is narrower than a chunk, so this is at most two words
+    auto chunk_y = y / MAP_CHUNK_SIZE;
+    auto row = y % MAP_CHUNK_SIZE;
+    for (int chunk_x = x_begin / MAP_CHUNK_SIZE; chunk_x <= x_end / MAP_CHUNK_SIZE; chunk_x++)
+    {
+        auto first = std::max(x_begin - chunk_x * MAP_CHUNK_SIZE, 0);
+        auto last = std::min(x_end - chunk_x * MAP_CHUNK_SIZE, MAP_CHUNK_SIZE - 1);
+        if (chunk(chunk_x, chunk_y).rows[row] & bit_range(first, last))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CollisionMap::any_solid_in_column(int x, int y_begin, int y_end) const
+{
+    y_begin = std::max(y_begin, 0);
+    y_end = std::min(y_end, height_ - 1);
+    if (x < 0 || x >= width_ || y_begin > y_end)
+    {
+        return false;
+    }
+
+    auto chunk_x = x / MAP_CHUNK_SIZE;
+    auto column = x % MAP_CHUNK_SIZE;
+    for (int chunk_y = y_begin / MAP_CHUNK_SIZE; chunk_y <= y_end / MAP_CHUNK_SIZE; chunk_y++)
+    {
+        auto first = std::max(y_begin - chunk_y * MAP_CHUNK_SIZE, 0);
+        auto last = std::min(y_end - chunk_y * MAP_CHUNK_SIZE, MAP_CHUNK_SIZE - 1);
+        if (chunk(chunk_x, chunk_y).columns[column] & bit_range(first, last))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+int CollisionMap::width() const
+{
+    return width_;
+}
+
+int CollisionMap::height() const
+{
+    return height_;
+}
+
+sf::Vector2f CollisionMap::pixel_size() const
+{
+    return {static_cast<float>(width_) * TILE_SIZE, static_cast<float>(height_) * TILE_SIZE};
+}
+
+int CollisionMap::chunk_count() const
+{
+    return static_cast<int>(chunks_.size());
+}
+
+int CollisionMap::chunks_x() const
+{
+    return chunks_x_;
+}
+
+const MapChunk& CollisionMap::chunk(int index) const
+{
+    return chunks_[index];
+}
+
+std::vector<u64> CollisionMap::chunk_hashes() const
+{
+    if (!file_hashes_.empty())
+    {
+        return {file_hashes_.begin(), file_hashes_.end()};
+    }
+
+    std::vector<u64> hashes(chunks_.size());
+    for (size_t i = 0; i < chunks_.size(); i++)
+    {
+        hashes[i] = chunks_[i].hash();
+    }
+    return hashes;
+}
+
+const MapChunk& CollisionMap::chunk(int chunk_x, int chunk_y) const
+{
+    return chunks_[chunk_y * chunks_x_ + chunk_x];
+}
+
+CollisionMap make_built_in_map(int width, int height)
+{
+    CollisionMap map(width, height);
+    for (int y = 0; y < map.height(); y++)
+    {
+        for (int x = 0; x < map.width(); x++)
+        {
+            map.set_solid(x, y, MAP[(y % MAP_SIZE) * MAP_SIZE + x % MAP_SIZE] != 0);
+        }
+    }
+    return map;
+}
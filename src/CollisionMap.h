@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "Common.h"
+#include "Util/MappedFile.h"
+
+/// Width and height in tiles of each chunk of a CollisionMap, one bit for each tile of a row fits a
+/// single word
+constexpr int MAP_CHUNK_SIZE = 64;
+
+/// Largest width or height in tiles of a map, so positions across it still fit the fixed point
+/// that snapshots use
+constexpr int MAX_MAP_TILES = 16384;
+
+/// The solid tiles of a square of the map. Each tile is stored twice, once in the word of its row
+/// and once in the word of its column, so a run of tiles along either axis is tested with one mask
+struct MapChunk
+{
+    /// Bit x of row y is set if tile (x, y) of the chunk is solid
+    std::array<u64, MAP_CHUNK_SIZE> rows{};
+
+    /// Bit y of column x is set if tile (x, y) of the chunk is solid
+    std::array<u64, MAP_CHUNK_SIZE> columns{};
+
+    /// Rebuilds the columns from the rows
+    void fill_columns();
+
+    /// Content hash of the tiles. Clients cache chunks by this, so chunks they have seen before
+    /// (from an earlier connection, or repeated elsewhere in the map) are not sent again
+    [[nodiscard]] u64 hash() const;
+};
+
+/// One bit for each tile saying if it is solid, split into chunks. Tiles outside of the map are
+/// empty.
+///
+/// A map is either built in memory, or loaded from a map file. Map files are a header followed by
+/// the chunks exactly as they are stored in memory, so loading one just maps the file and the
+/// chunks are read from disk as they are first used. The hash of each chunk is stored after the
+/// chunks, so they can be sent to clients without reading every chunk.
+class CollisionMap
+{
+  public:
+    /// An empty map of the given size in tiles
+    CollisionMap(int width, int height);
+
+    CollisionMap(CollisionMap&&) = default;
+    CollisionMap& operator=(CollisionMap&&) = default;
+    CollisionMap(const CollisionMap&) = delete;
+    CollisionMap& operator=(const CollisionMap&) = delete;
+
+    /// Returns nullopt if the file can not be read, or is not a valid map file
+    [[nodiscard]] static std::optional<CollisionMap> load(const std::string& path);
+
+    /// Returns false if the file could not be written
+    [[nodiscard]] bool save(const std::string& path) const;
+
+    /// Only maps built in memory can be changed, not maps loaded from a file
+    void set_solid(int x, int y, bool solid);
+
+    /// Replaces the tiles of a chunk. Like set_solid, only for maps built in memory
+    void set_chunk(int index, const MapChunk& tiles);
+
+    [[nodiscard]] bool is_solid(int x, int y) const;
+
+    /// If any of the tiles from `x_begin` to `x_end` (inclusive) in row `y` are solid
+    [[nodiscard]] bool any_solid_in_row(int y, int x_begin, int x_end) const;
+
+    /// If any of the tiles from `y_begin` to `y_end` (inclusive) in column `x` are solid
+    [[nodiscard]] bool any_solid_in_column(int x, int y_begin, int y_end) const;
+
+    [[nodiscard]] int width() const;
+    [[nodiscard]] int height() const;
+
+    /// Size of the map in pixels
+    [[nodiscard]] sf::Vector2f pixel_size() const;
+
+    /// Chunks are indexed row by row, `chunks_x()` to a row
+    [[nodiscard]] int chunk_count() const;
+    [[nodiscard]] int chunks_x() const;
+    [[nodiscard]] const MapChunk& chunk(int index) const;
+
+    /// The hash of every chunk in order. Read from the file for maps loaded from one, otherwise
+    /// worked out from the chunks
+    [[nodiscard]] std::vector<u64> chunk_hashes() const;
+
+  private:
+    CollisionMap() = default;
+
+    [[nodiscard]] const MapChunk& chunk(int chunk_x, int chunk_y) const;
+
+    int width_ = 0;
+    int height_ = 0;
+
+    /// Number of chunks across, the chunks along the right and bottom edges are padded with empty
+    /// tiles
+    int chunks_x_ = 0;
+
+    /// Points into either `owned_chunks_` or `file_`
+    std::span<const MapChunk> chunks_;
+
+    /// Points into `file_`, empty for maps built in memory
+    std::span<const u64> file_hashes_;
+    std::vector<MapChunk> owned_chunks_;
+    MappedFile file_;
+};
+
+/// The map built into the game, repeated to fill the width and height
+[[nodiscard]] CollisionMap make_built_in_map(int width = MAP_SIZE, int height = MAP_SIZE);
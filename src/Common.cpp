@@ -4,10 +4,67 @@
 #include <limits>
 #include <print>
 
-#include "Util/Util.h"
+#include "CollisionMap.h"
 
 constexpr float SPEED = 25;
-constexpr float MAX_SPEED = TILE_SIZE;
+
+namespace
+{
+    /// Tile that a position is in. Rounds down by hand, as std::floor is a library call without
+    /// SSE4.1 and this is run several times for every move
+    int first_tile(float position)
+    {
+        auto tiles = position / TILE_SIZE;
+        auto tile = static_cast<int>(tiles);
+        return tile - (static_cast<float>(tile) > tiles);
+    }
+
+    /// Last tile before a position, for the far edge of a box which is just outside of it
+    int last_tile(float position)
+    {
+        auto tiles = position / TILE_SIZE;
+        auto tile = static_cast<int>(tiles);
+        return tile + (static_cast<float>(tile) < tiles) - 1;
+    }
+
+    /// Moves the span [start, start + length) along one axis by the velocity, stepping through each
+    /// line of tiles the leading edge crosses until `is_solid(tile)` says that line is blocked
+    /// alongside the box. Only the lines crossed are tested, so the cost does not depend on the
+    /// size of the box, and fast moves can not skip over a tile. Tiles the box already overlaps are
+    /// never tested, so a box stuck in a tile can get out. Returns true if the move was blocked
+    template <typename IsSolid>
+    bool sweep_axis(float& start, float length, float& velocity, IsSolid&& is_solid)
+    {
+        if (velocity > 0)
+        {
+            auto end = start + length;
+            for (int tile = last_tile(end) + 1; tile <= last_tile(end + velocity); tile++)
+            {
+                if (is_solid(tile))
+                {
+                    start = tile * TILE_SIZE - length;
+                    velocity = 0;
+                    return true;
+                }
+            }
+        }
+        else if (velocity < 0)
+        {
+            for (int tile = first_tile(start) - 1; tile >= first_tile(start + velocity); tile--)
+            {
+                if (is_solid(tile))
+                {
+                    start = (tile + 1) * TILE_SIZE;
+                    velocity = 0;
+                    return true;
+                }
+            }
+        }
+
+        start += velocity;
+        return false;
+    }
+} // namespace
 
 void process_input_for_player(EntityTransform& transform, const Input& input) noexcept
 {
@@ -33,89 +90,42 @@ void process_input_for_player(EntityTransform& transform, const Input& input) no
     velocity += change * input.dt;
 }
 
-void apply_map_collisions(EntityTransform& transform)
+void apply_map_collisions(EntityTransform& transform, const CollisionMap& map)
 {
-    auto& velocity = transform.velocity;
-    auto& position = transform.position;
-    auto i_pos = sf::Vector2i{position};
-    auto& size = transform.size;
-
-    velocity.x = std::clamp(velocity.x, -MAX_SPEED, MAX_SPEED) * 0.94f;
-    velocity.y = std::clamp(velocity.y, -MAX_SPEED, MAX_SPEED) * 0.98f;
-
-    auto next_position = position + velocity;
+    damp_velocity(transform.velocity);
+    move_with_map_collisions(transform, map);
+}
 
-    transform.is_grounded = false;
-    if (velocity.x > 0)
-    {
-        for (int y = i_pos.y; y < i_pos.y + size.y; y += 4)
-        {
-            auto x_tile = static_cast<int>((position.x + size.x + velocity.x) / TILE_SIZE);
-            auto y_tile = static_cast<int>(y / TILE_SIZE);
-            if (get_tile(x_tile, y_tile))
-            {
-                velocity.x = 0;
-                next_position.x = x_tile * TILE_SIZE - size.x;
-            }
-        }
-    }
-    else if (velocity.x < 0)
-    {
-        for (int y = i_pos.y; y < i_pos.y + size.y; y += 4)
-        {
-            auto x_tile = static_cast<int>((position.x + velocity.x) / TILE_SIZE);
-            auto y_tile = static_cast<int>(y / TILE_SIZE);
-            if (get_tile(x_tile, y_tile))
-            {
-                velocity.x = 0;
-                next_position.x = x_tile * TILE_SIZE + TILE_SIZE;
-            }
-        }
-    }
+void damp_velocity(sf::Vector2f& velocity)
+{
+    velocity.x = std::clamp(velocity.x, -MAX_SPEED, MAX_SPEED) * HORIZONTAL_DAMPING;
+    velocity.y = std::clamp(velocity.y, -MAX_SPEED, MAX_SPEED) * VERTICAL_DAMPING;
+}
 
-    if (velocity.y > 0)
-    {
+void move_with_map_collisions(EntityTransform& transform, const CollisionMap& map)
+{
+    auto& velocity = transform.velocity;
+    auto& position = transform.position;
+    const auto& size = transform.size;
 
-        for (int x = i_pos.x; x < i_pos.x + size.x; x += 4)
-        {
-            auto x_tile = static_cast<int>(x / TILE_SIZE);
-            int y_tile = (position.y + size.y + velocity.y) / TILE_SIZE;
-            if (get_tile(x_tile, y_tile))
-            {
-                velocity.y = 0;
-                next_position.y = y_tile * TILE_SIZE - size.y;
-                transform.is_grounded = true;
-            }
-        }
-    }
-    else if (velocity.y < 0)
-    {
+    // Swept along x and then y, so the y sweep starts from where the box ended up on x and can not
+    // clip the corner of a tile. Each line of tiles crossed is tested with one mask over the rows
+    // or columns the box covers
+    auto first_row = first_tile(position.y);
+    auto last_row = last_tile(position.y + size.y);
+    sweep_axis(position.x, size.x, velocity.x,
+               [&](int x) { return map.any_solid_in_column(x, first_row, last_row); });
 
-        for (int x = i_pos.x; x < i_pos.x + size.x; x += 4)
-        {
-            auto x_tile = static_cast<int>(x / TILE_SIZE);
-            int y_tile = (position.y + velocity.y - 1) / TILE_SIZE;
-            if (get_tile(x_tile, y_tile))
-            {
-                velocity.y = 0;
-                next_position.y = y_tile * TILE_SIZE + TILE_SIZE;
-            }
-        }
-    }
+    auto first_column = first_tile(position.x);
+    auto last_column = last_tile(position.x + size.x);
+    auto is_falling = velocity.y > 0;
+    auto blocked = sweep_axis(position.y, size.y, velocity.y, [&](int y)
+                              { return map.any_solid_in_row(y, first_column, last_column); });
 
+    transform.is_grounded = is_falling && blocked;
     if (!transform.is_grounded)
     {
         transform.velocity.y += 0.35f;
     }
-
-    position = next_position;
 }
 
-int get_tile(int x, int y)
-{
-    if (x < 0 || x >= MAP_SIZE || y < 0 || y >= MAP_SIZE)
-    {
-        return 0;
-    }
-    return MAP[y * MAP_SIZE + x];
-}
@@ -21,6 +21,10 @@ constexpr i32 MAP_SIZE = 32;
 constexpr float TILE_SIZE = 32;
 constexpr float I_TILE_SIZE = static_cast<int>(TILE_SIZE);
 
+constexpr float MAX_SPEED = TILE_SIZE;
+constexpr float HORIZONTAL_DAMPING = 0.94f;
+constexpr float VERTICAL_DAMPING = 0.98f;
+
 enum InputKeyPress
 {
     NONE = 0,
@@ -45,6 +49,9 @@ struct EntityTransform
     bool is_grounded = false;
 };
 
+/// Players are taller than the default entity size
+constexpr sf::Vector2f PLAYER_SIZE = {24, 48};
+
 struct EntityCommon
 {
     EntityTransform transform;
@@ -52,9 +59,18 @@ struct EntityCommon
     bool active = false;
 };
 
+class CollisionMap;
+
 void process_input_for_player(EntityTransform& transform, const Input& input) noexcept;
-void apply_map_collisions(EntityTransform& transform);
+void apply_map_collisions(EntityTransform& transform, const CollisionMap& map);
 
+/// The first half of apply_map_collisions, clamps the velocity to the max speed and slows it down
+void damp_velocity(sf::Vector2f& velocity);
+
+/// The second half of apply_map_collisions, moves by the velocity unless blocked by a tile
+void move_with_map_collisions(EntityTransform& transform, const CollisionMap& map);
+
+/// The map built into the game, used when no map file is given
 constexpr std::array<int, MAP_SIZE* MAP_SIZE> MAP = {
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -89,5 +105,3 @@ constexpr std::array<int, MAP_SIZE* MAP_SIZE> MAP = {
     1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
     1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
 };
-
-int get_tile(int x, int y);
\ No newline at end of file
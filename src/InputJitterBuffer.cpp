@@ -0,0 +1,100 @@
+#include "InputJitterBuffer.h"
+
+#include <algorithm>
+#include <bit>
+
+static_assert(INPUT_BUFFER_CAPACITY == 64, "One bit of `filled_` for each slot");
+
+bool InputJitterBuffer::push(const Input& input)
+{
+    if (!(input.dt >= 0 && input.dt <= MAX_INPUT_DT))
+    {
+        return false;
+    }
+
+    if (!started_)
+    {
+        next_sequence_ = input.sequence;
+        started_ = true;
+    }
+
+    // Unsigned, so inputs from before the window wrap around to far ahead of it
+    if (input.sequence - next_sequence_ >= INPUT_BUFFER_CAPACITY)
+    {
+        return false;
+    }
+
+    auto bit = u64{1} << (input.sequence % INPUT_BUFFER_CAPACITY);
+    if (filled_ & bit)
+    {
+        return false;
+    }
+    filled_ |= bit;
+    inputs_[input.sequence % INPUT_BUFFER_CAPACITY] = input;
+    count_++;
+    buffered_time_ += input.dt;
+    return true;
+}
+
+void InputJitterBuffer::begin_tick(float tick_time)
+{
+    // Nothing arrived in time for this tick, so build the delay back up before carrying on
+    if (count_ == 0)
+    {
+        primed_ = false;
+    }
+
+    auto rate = buffered_time_ > tick_time + INPUT_JITTER_DELAY ? INPUT_CATCH_UP_RATE : 1.0f;
+
+    // What is left of the budget carries over, but only up to the length of one input, so a player
+    // that stops sending can not save up time to spend all at once
+    time_budget_ = std::min(time_budget_ + tick_time * rate, tick_time * rate + MAX_INPUT_DT);
+    inputs_this_tick_ = 0;
+}
+
+std::optional<Input> InputJitterBuffer::pop()
+{
+    if (!primed_)
+    {
+        if (buffered_time_ < INPUT_JITTER_DELAY)
+        {
+            return std::nullopt;
+        }
+        primed_ = true;
+    }
+    if (count_ == 0 || inputs_this_tick_ >= MAX_INPUTS_PER_TICK)
+    {
+        return std::nullopt;
+    }
+
+    // Skip past any inputs that are missing to the first one held, rotating the bits so the slot of
+    // the next sequence is bit 0
+    auto offset = static_cast<int>(next_sequence_ % INPUT_BUFFER_CAPACITY);
+    auto skipped = std::countr_zero(std::rotr(filled_, offset));
+    auto sequence = next_sequence_ + static_cast<u32>(skipped);
+    auto slot = sequence % INPUT_BUFFER_CAPACITY;
+
+    const auto& input = inputs_[slot];
+    if (input.dt > time_budget_)
+    {
+        return std::nullopt;
+    }
+
+    filled_ &= ~(u64{1} << slot);
+    next_sequence_ = sequence + 1;
+    count_--;
+    buffered_time_ = count_ > 0 ? buffered_time_ - input.dt : 0;
+    time_budget_ -= input.dt;
+    inputs_this_tick_++;
+    return input;
+}
+
+int InputJitterBuffer::size() const
+{
+    return count_;
+}
+
+void InputJitterBuffer::clear()
+{
+    *this = {};
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <optional>
+
+#include "Common.h"
+
+/// Inputs held for each player, a window of sequence numbers from the next input to simulate. One
+/// bit of a word marks each slot that holds an input
+constexpr u32 INPUT_BUFFER_CAPACITY = 64;
+
+/// Inputs with a longer frame time than this are dropped rather than simulated
+constexpr float MAX_INPUT_DT = 0.16f;
+
+/// Seconds of input held back before a player's inputs are simulated, both when it connects and
+/// whenever its inputs run out, so inputs that arrive a little late do not leave ticks without any
+constexpr float INPUT_JITTER_DELAY = 0.03f;
+
+/// Most inputs simulated for a player each tick, however short their frame times are
+constexpr int MAX_INPUTS_PER_TICK = 32;
+
+/// How much faster than real time a player's inputs are simulated while more than a tick of them
+/// has backed up, so the backlog is worked through rather than adding latency forever
+constexpr float INPUT_CATCH_UP_RATE = 1.25f;
+
+/// The inputs of a player waiting to be simulated, kept in order of sequence.
+///
+/// Each tick gives the player a budget of simulation time equal to the tick (a little more while it
+/// is catching up), and inputs are only taken while their frame times fit in it. However fast a
+/// client sends inputs, it is only simulated as fast as the server runs, and never for more than
+/// MAX_INPUTS_PER_TICK inputs a tick.
+class InputJitterBuffer
+{
+  public:
+    /// Returns false if the input was dropped, as it has already been simulated or skipped, is a
+    /// duplicate, is too far ahead of the next input, or has a frame time out of range
+    bool push(const Input& input);
+
+    /// Adds the time of a tick to the budget, call before taking the inputs of the tick
+    void begin_tick(float tick_time);
+
+    /// The next input to simulate this tick, or nullopt once the budget is spent or there are no
+    /// inputs ready. Inputs that never arrived are skipped
+    [[nodiscard]] std::optional<Input> pop();
+
+    /// Number of inputs held
+    [[nodiscard]] int size() const;
+
+    void clear();
+
+  private:
+    std::array<Input, INPUT_BUFFER_CAPACITY> inputs_;
+
+    /// Bit `sequence % INPUT_BUFFER_CAPACITY` is set if that slot holds an input
+    u64 filled_ = 0;
+
+    /// Sequence of the next input to simulate. Set by the first input pushed, as clients do not
+    /// start from 0 when they reconnect
+    u32 next_sequence_ = 0;
+    bool started_ = false;
+
+    int count_ = 0;
+
+    /// Total frame time of the inputs held
+    float buffered_time_ = 0;
+
+    /// Simulation time left this tick
+    float time_budget_ = 0;
+    int inputs_this_tick_ = 0;
+
+    /// False while the jitter delay is building up
+    bool primed_ = false;
+};
@@ -0,0 +1,150 @@
+#include "Interpolation.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    /// Fraction of each new measurement that goes into the averages, so they follow a change in
+    /// the connection over a second or so while ignoring one odd snapshot
+    constexpr float SMOOTHING = 1.0f / 16;
+
+    /// Extra snapshots of delay to ride out losing this many in a row is kept under this chance
+    constexpr float LOSS_RUN_CHANCE = 0.01f;
+    constexpr int MAX_LOSS_RUN = 4;
+
+    /// Jitter is an average, so the delay allows for arrivals a few times later than it
+    constexpr float JITTER_MARGIN = 2.0f;
+} // namespace
+
+void PositionHistory::push(sf::Time timestamp, sf::Vector2f position)
+{
+    if (count_ == samples_.size())
+    {
+        first_ = (first_ + 1) % samples_.size();
+        count_--;
+    }
+    samples_[(first_ + count_) % samples_.size()] = {.timestamp = timestamp, .position = position};
+    count_++;
+}
+
+void PositionHistory::clear()
+{
+    first_ = 0;
+    count_ = 0;
+}
+
+size_t PositionHistory::size() const
+{
+    return count_;
+}
+
+std::optional<sf::Vector2f> PositionHistory::sample(sf::Time time)
+{
+    if (count_ < 2)
+    {
+        return std::nullopt;
+    }
+
+    while (count_ > 2 && at(1).timestamp <= time)
+    {
+        first_ = (first_ + 1) % samples_.size();
+        count_--;
+    }
+
+    const auto& [t0, p0] = at(0);
+    const auto& [t1, p1] = at(1);
+    if (time < t0 || time > t1)
+    {
+        return std::nullopt;
+    }
+
+    auto t = t1 > t0 ? (time - t0) / (t1 - t0) : 1.0f;
+    return sf::Vector2f{std::lerp(p0.x, p1.x, t), std::lerp(p0.y, p1.y, t)};
+}
+
+const PositionHistory::Sample& PositionHistory::at(size_t index) const
+{
+    return samples_[(first_ + index) % samples_.size()];
+}
+
+InterpolationDelay::InterpolationDelay(float expected_interval)
+    : expected_interval_(expected_interval)
+    , interval_(expected_interval)
+    , delay_(std::clamp(expected_interval * 2, MIN_INTERPOLATION_DELAY, MAX_INTERPOLATION_DELAY))
+{
+}
+
+void InterpolationDelay::on_snapshot(u32 sequence, sf::Time arrival)
+{
+    // Sequences are only compared by their difference, so they may wrap
+    if (last_sequence_ != 0)
+    {
+        auto gap = sequence - last_sequence_;
+        if (gap == 0 || last_sequence_ - sequence <= MAX_LATE_SNAPSHOTS)
+        {
+            return;
+        }
+
+        // The arrival times of the old sequence say nothing about the new one
+        if (gap >= 0x80000000u)
+        {
+            interval_ = expected_interval_;
+            jitter_ = 0;
+            loss_ = 0;
+            last_sequence_ = sequence;
+            last_arrival_ = arrival;
+            return;
+        }
+
+        // The arrival times are compared with where they would be if the snapshots came at a
+        // steady rate, as in RFC 3550
+        auto elapsed = (arrival - last_arrival_).asSeconds();
+        interval_ += (elapsed / gap - interval_) * SMOOTHING;
+        jitter_ += (std::abs(elapsed - interval_ * gap) - jitter_) * SMOOTHING;
+        loss_ += ((gap - 1.0f) / gap - loss_) * SMOOTHING;
+    }
+    last_sequence_ = sequence;
+    last_arrival_ = arrival;
+}
+
+void InterpolationDelay::update(sf::Time dt)
+{
+    auto step = dt.asSeconds() * INTERPOLATION_DELAY_SLEW;
+    delay_ += std::clamp(target().asSeconds() - delay_, -step, step);
+}
+
+sf::Time InterpolationDelay::delay() const
+{
+    return sf::seconds(delay_);
+}
+
+sf::Time InterpolationDelay::target() const
+{
+    // One interval so there is a snapshot to move towards, and enough more that losing that many
+    // in a row is unlikely: a loss of p loses n in a row with a chance of p^n
+    float loss_run = 0;
+    if (loss_ > 0.001f)
+    {
+        loss_run = std::ceil(std::log(LOSS_RUN_CHANCE) / std::log(std::min(loss_, 0.99f)));
+    }
+    loss_run = std::min(loss_run, static_cast<float>(MAX_LOSS_RUN));
+
+    auto target = interval_ * (1 + loss_run) + jitter_ * JITTER_MARGIN;
+    return sf::seconds(std::clamp(target, MIN_INTERPOLATION_DELAY, MAX_INTERPOLATION_DELAY));
+}
+
+sf::Time InterpolationDelay::interval() const
+{
+    return sf::seconds(interval_);
+}
+
+sf::Time InterpolationDelay::jitter() const
+{
+    return sf::seconds(jitter_);
+}
+
+float InterpolationDelay::loss() const
+{
+    return loss_;
+}
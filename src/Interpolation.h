@@ -0,0 +1,97 @@
+#pragma once
+
+#include <array>
+#include <optional>
+
+#include <SFML/System/Time.hpp>
+#include <SFML/System/Vector2.hpp>
+
+#include "Common.h"
+
+/// Positions kept for each entity to interpolate between. Comfortably more than are received over
+/// the longest interpolation delay
+constexpr size_t POSITION_HISTORY_SIZE = 16;
+
+/// Bounds of the interpolation delay, however good or bad the connection is
+constexpr float MIN_INTERPOLATION_DELAY = 0.02f;
+constexpr float MAX_INTERPOLATION_DELAY = 0.5f;
+
+/// How fast the interpolation delay moves towards its target, as a fraction of real time. Rendering
+/// runs at most this much faster or slower than real time while it changes, so it is not noticed
+constexpr float INTERPOLATION_DELAY_SLEW = 0.1f;
+
+/// Snapshots up to this many sequences behind the latest are late, and are ignored. Any further
+/// behind and the sequences have started again, from a new connection or server
+constexpr u32 MAX_LATE_SNAPSHOTS = 64;
+
+/// The positions an entity was sent at, oldest first. Once full, each new position replaces the
+/// oldest rather than growing
+class PositionHistory
+{
+  public:
+    struct Sample
+    {
+        sf::Time timestamp;
+        sf::Vector2f position;
+    };
+
+    void push(sf::Time timestamp, sf::Vector2f position);
+    void clear();
+
+    [[nodiscard]] size_t size() const;
+
+    /// The position at `time`, interpolated between the samples either side of it. Returns nullopt
+    /// if it is not between two samples. Samples from before the pair are dropped, so `time` should
+    /// only move forwards
+    [[nodiscard]] std::optional<sf::Vector2f> sample(sf::Time time);
+
+  private:
+    [[nodiscard]] const Sample& at(size_t index) const;
+
+    std::array<Sample, POSITION_HISTORY_SIZE> samples_;
+
+    /// Index of the oldest sample
+    size_t first_ = 0;
+    size_t count_ = 0;
+};
+
+/// Chooses how far in the past entities are rendered, from how regularly snapshots arrive. Enough
+/// to always have a snapshot to interpolate towards despite jitter and lost snapshots, and no more
+class InterpolationDelay
+{
+  public:
+    /// `expected_interval` is the time between snapshots in seconds to assume until they arrive
+    explicit InterpolationDelay(float expected_interval);
+
+    /// Call for each new snapshot as it arrives. Late or repeated sequences are ignored, and a
+    /// sequence that has started again starts the measurements again
+    void on_snapshot(u32 sequence, sf::Time arrival);
+
+    /// Moves the delay towards the target, call once a frame
+    void update(sf::Time dt);
+
+    [[nodiscard]] sf::Time delay() const;
+
+    /// The delay the current conditions call for, which `delay()` moves towards
+    [[nodiscard]] sf::Time target() const;
+
+    /// Time between snapshots, and the average difference of their arrival times from that
+    [[nodiscard]] sf::Time interval() const;
+    [[nodiscard]] sf::Time jitter() const;
+
+    /// Fraction of snapshots that never arrived
+    [[nodiscard]] float loss() const;
+
+  private:
+    float expected_interval_ = 0;
+
+    u32 last_sequence_ = 0;
+    sf::Time last_arrival_;
+
+    /// Averages in seconds, updated by a fraction of each new measurement
+    float interval_ = 0;
+    float jitter_ = 0;
+    float loss_ = 0;
+
+    float delay_ = 0;
+};
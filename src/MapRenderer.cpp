@@ -0,0 +1,103 @@
+#include "MapRenderer.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#include "Util/Util.h"
+
+namespace
+{
+    constexpr float CHUNK_PIXELS = MAP_CHUNK_SIZE * TILE_SIZE;
+
+    /// Each tile is a green square with a white outline a pixel wide drawn around it
+    const sf::Color TILE_COLOUR = sf::Color::Green;
+    const sf::Color TILE_OUTLINE_COLOUR = sf::Color::White;
+    constexpr float TILE_OUTLINE_THICKNESS = 1;
+
+    sf::VertexArray build_chunk(const CollisionMap& map, int index)
+    {
+        sf::VertexArray vertices(sf::PrimitiveType::Triangles);
+        const auto& chunk = map.chunk(index);
+        sf::Vector2f origin{static_cast<float>(index % map.chunks_x()) * CHUNK_PIXELS,
+                            static_cast<float>(index / map.chunks_x()) * CHUNK_PIXELS};
+
+        // Tiles are added row by row, with the outline under the tile, so they overlap just as
+        // drawing them one at a time did
+        for (int y = 0; y < MAP_CHUNK_SIZE; y++)
+        {
+            for (auto bits = chunk.rows[y]; bits != 0; bits &= bits - 1)
+            {
+                auto x = std::countr_zero(bits);
+                auto position = origin + sf::Vector2f{x * TILE_SIZE, y * TILE_SIZE};
+                append_quad(vertices, position - sf::Vector2f{1, 1} * TILE_OUTLINE_THICKNESS,
+                            sf::Vector2f{1, 1} * (TILE_SIZE + TILE_OUTLINE_THICKNESS * 2),
+                            TILE_OUTLINE_COLOUR);
+                append_quad(vertices, position, {TILE_SIZE, TILE_SIZE}, TILE_COLOUR);
+            }
+        }
+        return vertices;
+    }
+} // namespace
+
+void MapRenderer::invalidate(std::span<const u32> chunks)
+{
+    if (chunks.empty())
+    {
+        return;
+    }
+    std::erase_if(cached_,
+                  [&](const CachedChunk& cached)
+                  {
+                      return std::ranges::find(chunks, static_cast<u32>(cached.index)) !=
+                             chunks.end();
+                  });
+}
+
+void MapRenderer::draw(sf::RenderTarget& target, const CollisionMap& map)
+{
+    if (map.chunk_count() == 0)
+    {
+        cached_.clear();
+        return;
+    }
+
+    // The chunks the view overlaps, widened by the outline that hangs over the edge of each tile
+    const auto& view = target.getView();
+    auto top_left = view.getCenter() - view.getSize() / 2.0f;
+    auto bottom_right = view.getCenter() + view.getSize() / 2.0f;
+    auto chunks_y = map.chunk_count() / map.chunks_x();
+    auto to_chunk = [](float pixels, int chunk_count)
+    { return std::clamp(static_cast<int>(std::floor(pixels / CHUNK_PIXELS)), 0, chunk_count - 1); };
+    auto first_x = to_chunk(top_left.x - TILE_OUTLINE_THICKNESS, map.chunks_x());
+    auto first_y = to_chunk(top_left.y - TILE_OUTLINE_THICKNESS, chunks_y);
+    auto last_x = to_chunk(bottom_right.x + TILE_OUTLINE_THICKNESS, map.chunks_x());
+    auto last_y = to_chunk(bottom_right.y + TILE_OUTLINE_THICKNESS, chunks_y);
+
+    frame_++;
+    size_t in_view = 0;
+    for (int chunk_y = first_y; chunk_y <= last_y; chunk_y++)
+    {
+        for (int chunk_x = first_x; chunk_x <= last_x; chunk_x++)
+        {
+            auto index = chunk_y * map.chunks_x() + chunk_x;
+            auto cached = std::ranges::find(cached_, index, &CachedChunk::index);
+            if (cached == cached_.end())
+            {
+                cached = cached_.insert(cached_.end(),
+                                        {.index = index, .vertices = build_chunk(map, index)});
+            }
+            cached->last_drawn = frame_;
+            target.draw(cached->vertices);
+            in_view++;
+        }
+    }
+
+    // The chunks in view are all drawn this frame, so they are never the ones dropped
+    if (auto keep = in_view + MAP_RENDERER_SPARE_CHUNKS; cached_.size() > keep)
+    {
+        std::ranges::nth_element(cached_, cached_.begin() + static_cast<std::ptrdiff_t>(keep),
+                                 std::ranges::greater{}, &CachedChunk::last_drawn);
+        cached_.resize(keep);
+    }
+}
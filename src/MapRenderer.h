@@ -0,0 +1,40 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include <SFML/Graphics/RenderTarget.hpp>
+#include <SFML/Graphics/VertexArray.hpp>
+
+#include "CollisionMap.h"
+#include "Common.h"
+
+/// Chunks kept built after they leave the view, the least recently drawn going first. Moving back
+/// and forth over the edge of a chunk then does not rebuild it each time
+constexpr size_t MAP_RENDERER_SPARE_CHUNKS = 16;
+
+/// Draws the solid tiles of a map. The tiles of each chunk are built into a vertex array the first
+/// time the chunk is in view, and drawn with one call from then on. Only the chunks in the view of
+/// the target are built and drawn, so the cost of a frame does not depend on the size of the map.
+class MapRenderer
+{
+  public:
+    /// Throws away what was built for the chunks, so they are rebuilt when next drawn. Must be
+    /// told of every chunk that changes, and all of them when the map is replaced
+    void invalidate(std::span<const u32> chunks);
+
+    void draw(sf::RenderTarget& target, const CollisionMap& map);
+
+  private:
+    struct CachedChunk
+    {
+        int index = 0;
+        u64 last_drawn = 0;
+        sf::VertexArray vertices;
+    };
+
+    /// The chunks in view, and up to MAP_RENDERER_SPARE_CHUNKS that were in view recently, so this
+    /// only ever holds a handful
+    std::vector<CachedChunk> cached_;
+    u64 frame_ = 0;
+};
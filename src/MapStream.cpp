@@ -0,0 +1,368 @@
+#include "MapStream.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace
+{
+    constexpr int CHUNK_TILES = MAP_CHUNK_SIZE * MAP_CHUNK_SIZE;
+
+    /// Largest a chunk can be written as, when it is sent without run length encoding
+    constexpr size_t MAX_CHUNK_PACKET_SIZE =
+        (MESSAGE_TYPE_BITS + FIXED_BITS<MapChunkMessage> + 1 + CHUNK_TILES + 7) / 8;
+
+    bool tile_bit(const MapChunk& chunk, int tile)
+    {
+        return (chunk.rows[tile / MAP_CHUNK_SIZE] >> (tile % MAP_CHUNK_SIZE)) & 1;
+    }
+
+    void write_u64(BitWriter& writer, u64 value)
+    {
+        writer.write(static_cast<u32>(value), 32);
+        writer.write(static_cast<u32>(value >> 32), 32);
+    }
+
+    u64 read_u64(BitReader& reader)
+    {
+        u64 low = reader.read(32);
+        u64 high = reader.read(32);
+        return low | (high << 32);
+    }
+
+    /// Bits to write the tiles as runs of the same value, each run being its length less one. Maps
+    /// are mostly long runs of empty or solid tiles, so this is usually far smaller than a bit each
+    size_t run_length_bits(const MapChunk& chunk)
+    {
+        size_t bits = 1;
+        int run_start = 0;
+        for (int tile = 1; tile <= CHUNK_TILES; tile++)
+        {
+            if (tile == CHUNK_TILES || tile_bit(chunk, tile) != tile_bit(chunk, run_start))
+            {
+                bits += BitWriter::varint_bits(static_cast<u32>(tile - run_start - 1));
+                run_start = tile;
+            }
+        }
+        return bits;
+    }
+
+    /// The tiles follow a flag saying if they are run length encoded, or a bit each when that
+    /// would be smaller. Only the rows are sent, the columns are rebuilt from them
+    void write_chunk_tiles(BitWriter& writer, const MapChunk& chunk)
+    {
+        auto is_raw = run_length_bits(chunk) >= CHUNK_TILES;
+        writer.write(is_raw, 1);
+        if (is_raw)
+        {
+            for (auto row : chunk.rows)
+            {
+                write_u64(writer, row);
+            }
+            return;
+        }
+
+        writer.write(tile_bit(chunk, 0), 1);
+        int run_start = 0;
+        for (int tile = 1; tile <= CHUNK_TILES; tile++)
+        {
+            if (tile == CHUNK_TILES || tile_bit(chunk, tile) != tile_bit(chunk, run_start))
+            {
+                writer.write_varint(static_cast<u32>(tile - run_start - 1));
+                run_start = tile;
+            }
+        }
+    }
+
+    std::optional<MapChunk> read_chunk_tiles(BitReader& reader)
+    {
+        MapChunk chunk;
+        if (reader.read(1))
+        {
+            for (auto& row : chunk.rows)
+            {
+                row = read_u64(reader);
+            }
+        }
+        else
+        {
+            auto solid = reader.read(1) != 0;
+            int tile = 0;
+            while (tile < CHUNK_TILES && reader.is_valid())
+            {
+                auto run = static_cast<int>(std::min<u32>(reader.read_varint(), CHUNK_TILES)) + 1;
+                if (tile + run > CHUNK_TILES)
+                {
+                    return std::nullopt;
+                }
+                for (auto end = tile + run; solid && tile < end; tile++)
+                {
+                    chunk.rows[tile / MAP_CHUNK_SIZE] |= u64{1} << (tile % MAP_CHUNK_SIZE);
+                }
+                tile += solid ? 0 : run;
+                solid = !solid;
+            }
+        }
+
+        if (!reader.is_valid())
+        {
+            return std::nullopt;
+        }
+        chunk.fill_columns();
+        return chunk;
+    }
+} // namespace
+
+std::vector<u32> read_map_chunk_request(ToServerMessageReader& message, int chunk_count)
+{
+    std::vector<u32> chunks;
+    auto request = message.read<MapChunkRequestMessage>();
+    if (!request)
+    {
+        return chunks;
+    }
+
+    // The indices are sorted, so each is sent as the gap from the one before. The count is not
+    // trusted, the chunks only go as far as there is data
+    auto& reader = message.stream;
+    int previous = -1;
+    for (u32 i = 0; i < request->count && reader.is_valid(); i++)
+    {
+        auto index = static_cast<i64>(previous) + 1 + reader.read_varint();
+        if (!reader.is_valid() || index >= chunk_count)
+        {
+            break;
+        }
+        chunks.push_back(static_cast<u32>(index));
+        previous = static_cast<int>(index);
+    }
+    return chunks;
+}
+
+void MapSender::start()
+{
+    manifest_next_ = 0;
+    pending_.clear();
+}
+
+void MapSender::request(std::span<const u32> chunks, const CollisionMap& map, sf::Vector2f spawn)
+{
+    // The chunks around the spawn are sent first, as they are what the player needs to move
+    auto chunk_pixels = MAP_CHUNK_SIZE * TILE_SIZE;
+    auto spawn_x = static_cast<int>(spawn.x / chunk_pixels);
+    auto spawn_y = static_cast<int>(spawn.y / chunk_pixels);
+    auto distance = [&](u32 index)
+    {
+        auto dx = static_cast<i64>(index % map.chunks_x()) - spawn_x;
+        auto dy = static_cast<i64>(index / map.chunks_x()) - spawn_y;
+        return dx * dx + dy * dy;
+    };
+
+    // A request comes for each piece of the manifest, so only the new chunks are sorted and then
+    // merged into those already waiting
+    auto old_size = static_cast<std::ptrdiff_t>(pending_.size());
+    pending_.insert(pending_.end(), chunks.begin(), chunks.end());
+    auto middle = pending_.begin() + old_size;
+    std::ranges::stable_sort(middle, pending_.end(), std::ranges::greater{}, distance);
+    std::ranges::inplace_merge(pending_, middle, std::ranges::greater{}, distance);
+}
+
+std::vector<PacketWriter> MapSender::write_packets(const CollisionMap& map,
+                                                   std::span<const u64> hashes,
+                                                   size_t byte_budget)
+{
+    std::vector<PacketWriter> packets;
+    size_t bytes = 0;
+
+    // The client can only ask for chunks once it has their hashes, so the manifest goes first
+    while (manifest_next_ && bytes < byte_budget)
+    {
+        auto first = *manifest_next_;
+        auto count = std::min<u32>(MAP_MANIFEST_HASHES_PER_PACKET,
+                                   static_cast<u32>(hashes.size()) - first);
+        auto& writer =
+            packets
+                .emplace_back((MESSAGE_TYPE_BITS + FIXED_BITS<MapManifestMessage> + 7) / 8 +
+                              count * sizeof(u64))
+                .stream();
+        write_message(writer, MapManifestMessage{.map_width = static_cast<u16>(map.width()),
+                                                 .map_height = static_cast<u16>(map.height()),
+                                                 .first_chunk = first,
+                                                 .count = count});
+        for (auto hash : hashes.subspan(first, count))
+        {
+            write_u64(writer, hash);
+        }
+        bytes += writer.byte_count();
+
+        manifest_next_ = first + count;
+        if (*manifest_next_ >= hashes.size())
+        {
+            manifest_next_.reset();
+        }
+    }
+
+    while (!pending_.empty() && bytes < byte_budget)
+    {
+        auto index = pending_.back();
+        pending_.pop_back();
+
+        auto& writer = packets.emplace_back(MAX_CHUNK_PACKET_SIZE).stream();
+        write_message(writer, MapChunkMessage{.index = index});
+        write_chunk_tiles(writer, map.chunk(static_cast<int>(index)));
+        bytes += writer.byte_count();
+    }
+    return packets;
+}
+
+bool MapSender::is_done() const
+{
+    return !manifest_next_ && pending_.empty();
+}
+
+void MapSender::clear()
+{
+    manifest_next_.reset();
+    pending_.clear();
+}
+
+MapReceiver::MapReceiver(const std::string& cache_path)
+{
+    // The hash is worked out again from the tiles, so a damaged entry is a chunk no map asks for
+    std::ifstream file(cache_path, std::ios::binary);
+    MapChunk chunk;
+    while (cache_.size() < MAP_CACHE_MAX_CHUNKS &&
+           file.read(reinterpret_cast<char*>(chunk.rows.data()), sizeof(chunk.rows)))
+    {
+        chunk.fill_columns();
+        cache_.emplace(chunk.hash(), chunk);
+    }
+    file.close();
+
+    cache_file_.open(cache_path, std::ios::binary | std::ios::app);
+}
+
+void MapReceiver::start(int width, int height)
+{
+    map_ = CollisionMap(width, height);
+    pending_.clear();
+    pending_count_ = 0;
+
+    changed_chunks_.resize(map_.chunk_count());
+    std::iota(changed_chunks_.begin(), changed_chunks_.end(), 0u);
+}
+
+std::optional<ENetPacket*> MapReceiver::read_manifest(ToClientMessageReader& message)
+{
+    auto manifest = message.read<MapManifestMessage>();
+    if (!manifest)
+    {
+        return std::nullopt;
+    }
+    if (manifest->first_chunk == 0)
+    {
+        start(manifest->map_width, manifest->map_height);
+    }
+    else if (manifest->map_width != map_.width() || manifest->map_height != map_.height())
+    {
+        return std::nullopt;
+    }
+
+    auto& reader = message.stream;
+    std::vector<u32> request;
+    auto end = std::min<u64>(u64{manifest->first_chunk} + manifest->count, map_.chunk_count());
+    for (auto index = manifest->first_chunk; index < end; index++)
+    {
+        auto hash = read_u64(reader);
+        if (!reader.is_valid())
+        {
+            break;
+        }
+
+        if (auto cached = cache_.find(hash); cached != cache_.end())
+        {
+            map_.set_chunk(static_cast<int>(index), cached->second);
+            changed_chunks_.push_back(index);
+            continue;
+        }
+
+        auto& indices = pending_[hash];
+        if (indices.empty())
+        {
+            request.push_back(index);
+        }
+        indices.push_back(index);
+        pending_count_++;
+    }
+
+    if (request.empty())
+    {
+        return std::nullopt;
+    }
+
+    size_t bits = MESSAGE_TYPE_BITS + FIXED_BITS<MapChunkRequestMessage>;
+    int previous = -1;
+    for (auto index : request)
+    {
+        bits += BitWriter::varint_bits(static_cast<u32>(static_cast<int>(index) - previous - 1));
+        previous = static_cast<int>(index);
+    }
+
+    PacketWriter packet((bits + 7) / 8);
+    auto& writer = packet.stream();
+    write_message(writer, MapChunkRequestMessage{.count = static_cast<u32>(request.size())});
+    previous = -1;
+    for (auto index : request)
+    {
+        writer.write_varint(static_cast<u32>(static_cast<int>(index) - previous - 1));
+        previous = static_cast<int>(index);
+    }
+    return packet.release(ENET_PACKET_FLAG_RELIABLE);
+}
+
+void MapReceiver::read_chunk(ToClientMessageReader& message)
+{
+    auto header = message.read<MapChunkMessage>();
+    if (!header)
+    {
+        return;
+    }
+    auto chunk = read_chunk_tiles(message.stream);
+    if (!chunk)
+    {
+        return;
+    }
+
+    // Any other chunks with the same tiles were waiting on this one
+    auto hash = chunk->hash();
+    if (auto pending = pending_.find(hash); pending != pending_.end())
+    {
+        for (auto index : pending->second)
+        {
+            map_.set_chunk(static_cast<int>(index), *chunk);
+            changed_chunks_.push_back(index);
+        }
+        pending_count_ -= static_cast<int>(pending->second.size());
+        pending_.erase(pending);
+    }
+    if (cache_.size() < MAP_CACHE_MAX_CHUNKS && cache_.emplace(hash, *chunk).second &&
+        cache_file_)
+    {
+        cache_file_.write(reinterpret_cast<const char*>(chunk->rows.data()), sizeof(chunk->rows));
+        cache_file_.flush();
+    }
+}
+
+const CollisionMap& MapReceiver::map() const
+{
+    return map_;
+}
+
+int MapReceiver::pending_chunks() const
+{
+    return pending_count_;
+}
+
+std::vector<u32> MapReceiver::take_changed_chunks()
+{
+    return std::exchange(changed_chunks_, {});
+}
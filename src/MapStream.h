@@ -0,0 +1,108 @@
+#pragma once
+
+#include <fstream>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <SFML/System/Vector2.hpp>
+
+#include "CollisionMap.h"
+#include "Common.h"
+#include "NetworkMessage.h"
+
+/// Most bytes of map chunks sent to each client per tick. The map is sent on its own reliable
+/// channel, and this keeps it from taking the bandwidth the snapshots need
+constexpr size_t MAP_STREAM_BYTES_PER_TICK = 8 * 1024;
+
+/// Chunks are not sent to a client while it has more than this many bytes of reliable data that it
+/// has not yet acknowledged, so a slow or lossy connection is not flooded
+constexpr u32 MAP_STREAM_MAX_IN_TRANSIT = 32 * 1024;
+
+/// Chunk hashes in each piece of the map manifest, so a piece fits in a single packet. The pieces
+/// are sent within the same budget as the chunks
+constexpr u32 MAP_MANIFEST_HASHES_PER_PACKET = 128;
+
+/// Most chunks a client keeps in its cache file, which is 32 MiB of tiles. Chunks past this are
+/// still used, but are downloaded again next time
+constexpr size_t MAP_CACHE_MAX_CHUNKS = 64 * 1024;
+
+/// Reads the indices of the chunks a client asked for from a MapChunkRequestMessage. Stops at the
+/// first index that is not a chunk of the map
+[[nodiscard]] std::vector<u32> read_map_chunk_request(ToServerMessageReader& message,
+                                                      int chunk_count);
+
+/// The map still to be sent to a client. First the manifest, the hash of every chunk, which the
+/// client asks for the chunks it needs from. Then those chunks, nearest to its spawn first
+class MapSender
+{
+  public:
+    /// Starts sending the manifest from the first chunk
+    void start();
+
+    /// Queues the chunks the client asked for, along with those it asked for before
+    void request(std::span<const u32> chunks, const CollisionMap& map, sf::Vector2f spawn);
+
+    /// Writes the next pieces of the manifest and then chunks until the budget is spent. Each is
+    /// its own packet
+    [[nodiscard]] std::vector<PacketWriter> write_packets(const CollisionMap& map,
+                                                          std::span<const u64> hashes,
+                                                          size_t byte_budget);
+
+    [[nodiscard]] bool is_done() const;
+    void clear();
+
+  private:
+    /// The first chunk of the next piece of the manifest, nullopt once it has all been sent
+    std::optional<u32> manifest_next_;
+
+    /// Furthest from the spawn first, so the next chunk to send is at the back
+    std::vector<u32> pending_;
+};
+
+/// Builds the map on the client from the chunks the server streams to it. The chunks are kept by
+/// their hash in a cache file, so connecting again, even after the client restarts, costs nothing
+/// for the chunks it has.
+class MapReceiver
+{
+  public:
+    /// Loads the chunks cached by earlier runs. New chunks are added to the end of the file as they
+    /// arrive. A missing or unwritable file only means the chunks are not cached
+    explicit MapReceiver(const std::string& cache_path);
+
+    /// Fills in the chunks of the piece of the manifest that are cached, and returns the request for
+    /// the rest. Only one chunk of each hash is asked for, and returns nullopt if there is nothing
+    /// to ask for. The first piece starts an empty map of the size the server said
+    [[nodiscard]] std::optional<ENetPacket*> read_manifest(ToClientMessageReader& message);
+
+    /// Fills in the chunk, along with any others with the same hash
+    void read_chunk(ToClientMessageReader& message);
+
+    [[nodiscard]] const CollisionMap& map() const;
+
+    /// Number of chunks still waiting to arrive
+    [[nodiscard]] int pending_chunks() const;
+
+    /// The chunks filled in since the last call, so anything built from the tiles only has to
+    /// redo those. Starting a new map counts as changing every chunk
+    [[nodiscard]] std::vector<u32> take_changed_chunks();
+
+  private:
+    /// Starts an empty map, which fills in as the chunks arrive
+    void start(int width, int height);
+
+    CollisionMap map_ = make_built_in_map();
+
+    std::unordered_map<u64, MapChunk> cache_;
+
+    /// The rows of each cached chunk one after another, the columns are rebuilt from them
+    std::ofstream cache_file_;
+
+    /// The chunks that have been asked for, by hash
+    std::unordered_map<u64, std::vector<u32>> pending_;
+    int pending_count_ = 0;
+
+    std::vector<u32> changed_chunks_;
+};
@@ -0,0 +1,167 @@
+#include "NetworkMessage.h"
+
+#include <cassert>
+#include <cmath>
+
+namespace
+{
+    /// Frame times are sent as the change from the input before, zigzag encoded so a shorter frame
+    /// takes as few bits as a longer one
+    u32 zigzag(i32 value)
+    {
+        return (static_cast<u32>(value) << 1) ^ static_cast<u32>(value >> 31);
+    }
+
+    i32 unzigzag(u32 value)
+    {
+        return static_cast<i32>(value >> 1) ^ -static_cast<i32>(value & 1);
+    }
+} // namespace
+
+PacketWriter::PacketWriter(size_t capacity)
+    : packet_(enet_packet_create(nullptr, capacity, 0))
+{
+    // Without a packet the stream has no room, so the writes fail and release() gives nullptr
+    if (packet_)
+    {
+        stream_ = BitWriter(packet_->data, capacity);
+    }
+}
+
+PacketWriter::~PacketWriter()
+{
+    if (packet_)
+    {
+        enet_packet_destroy(packet_);
+    }
+}
+
+PacketWriter::PacketWriter(PacketWriter&& other) noexcept
+    : packet_(std::exchange(other.packet_, nullptr))
+    , stream_(std::exchange(other.stream_, {}))
+{
+}
+
+PacketWriter& PacketWriter::operator=(PacketWriter&& other) noexcept
+{
+    std::swap(packet_, other.packet_);
+    std::swap(stream_, other.stream_);
+    return *this;
+}
+
+BitWriter& PacketWriter::stream()
+{
+    return stream_;
+}
+
+ENetPacket* PacketWriter::release(ENetPacketFlag flags)
+{
+    // A message that did not fit would be sent cut short, so the packet is dropped instead
+    stream_.flush();
+    auto stream = std::exchange(stream_, {});
+    auto packet = std::exchange(packet_, nullptr);
+    if (!packet || !stream.is_valid())
+    {
+        if (packet)
+        {
+            enet_packet_destroy(packet);
+        }
+        return nullptr;
+    }
+
+    packet->dataLength = stream.byte_count();
+    packet->flags = flags;
+    return packet;
+}
+
+u16 quantize_input_dt(float dt)
+{
+    return static_cast<u16>(std::clamp(std::lround(dt / INPUT_DT_STEP), 0l, 0xFFFFl));
+}
+
+float dequantize_input_dt(u16 steps)
+{
+    return steps * INPUT_DT_STEP;
+}
+
+ENetPacket* write_input_message(std::span<const Input> inputs, u32 acked_snapshot)
+{
+    assert(!inputs.empty() && inputs.size() <= MAX_INPUTS_PER_MESSAGE);
+
+    // At most a 33 bit varint for the frame time of each input, and in the worst case every input
+    // starts a new run
+    auto max_input_bits = 33 + INPUT_KEY_BITS + BitWriter::varint_bits(MAX_INPUTS_PER_MESSAGE);
+    PacketWriter packet(
+        (MESSAGE_TYPE_BITS + FIXED_BITS<InputMessage> + inputs.size() * max_input_bits + 7) / 8);
+    auto& writer = packet.stream();
+    write_message(writer, InputMessage{.first_sequence = inputs.front().sequence,
+                                       .count = static_cast<u8>(inputs.size()),
+                                       .acked_snapshot = acked_snapshot});
+
+    // The first input is written as a change from a zero frame time
+    i32 previous_dt = 0;
+    for (size_t run_start = 0; run_start < inputs.size();)
+    {
+        auto keys = inputs[run_start].keys;
+        auto run_end = run_start + 1;
+        while (run_end < inputs.size() && inputs[run_end].keys == keys)
+        {
+            run_end++;
+        }
+
+        writer.write(keys, INPUT_KEY_BITS);
+        writer.write_varint(static_cast<u32>(run_end - run_start - 1));
+        for (auto i = run_start; i < run_end; i++)
+        {
+            auto dt = static_cast<i32>(quantize_input_dt(inputs[i].dt));
+            writer.write_varint(zigzag(dt - previous_dt));
+            previous_dt = dt;
+        }
+        run_start = run_end;
+    }
+    return packet.release(ENET_PACKET_FLAG_UNSEQUENCED);
+}
+
+std::optional<int> read_input_message(ToServerMessageReader& message,
+                                      std::span<Input, MAX_INPUTS_PER_MESSAGE> inputs,
+                                      u32& acked_snapshot)
+{
+    auto header = message.read<InputMessage>();
+    if (!header || header->count > MAX_INPUTS_PER_MESSAGE)
+    {
+        return std::nullopt;
+    }
+
+    // Wide enough that adding any change to a valid frame time can not overflow, so a change that
+    // would take it out of range is caught by the check rather than wrapping back into it
+    auto& reader = message.stream;
+    i64 dt = 0;
+    for (int i = 0; i < header->count && reader.is_valid();)
+    {
+        auto keys = static_cast<u8>(reader.read(INPUT_KEY_BITS));
+        auto run = reader.read_varint();
+        if (run >= static_cast<u32>(header->count - i))
+        {
+            return std::nullopt;
+        }
+
+        for (auto run_end = i + static_cast<int>(run) + 1; i < run_end; i++)
+        {
+            dt += unzigzag(reader.read_varint());
+            if (dt < 0 || dt > 0xFFFF)
+            {
+                return std::nullopt;
+            }
+            inputs[i] = {.sequence = header->first_sequence + static_cast<u32>(i),
+                         .dt = dequantize_input_dt(static_cast<u16>(dt)),
+                         .keys = keys};
+        }
+    }
+
+    if (!reader.is_valid())
+    {
+        return std::nullopt;
+    }
+    acked_snapshot = header->acked_snapshot;
+    return header->count;
+}
@@ -1,9 +1,18 @@
 #pragma once
 
-#include <SFML/Network/Packet.hpp>
+#include <algorithm>
+#include <bit>
+#include <optional>
+#include <span>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
 #include <enet/enet.h>
 
 #include "Common.h"
+#include "Util/BitStream.h"
 
 enum class ToServerMessageType : u8
 {
@@ -11,6 +20,8 @@ enum class ToServerMessageType : u8
     Message,
 
     Input,
+
+    MapChunkRequest,
 };
 
 enum class ToClientMessage : u8
@@ -24,40 +35,480 @@ enum class ToClientMessage : u8
     PlayerLeave,
 
     Snapshot,
+
+    MapManifest,
+    MapChunk,
+};
+
+/// ENet channels. Snapshots and inputs are sent unreliably on their own channels, so a lost packet
+/// never holds up the reliable messages (chat, joins) behind a resend, or the other way around.
+/// The map is streamed on a reliable channel of its own, so chat and joins are not queued behind it
+constexpr u8 CHANNEL_RELIABLE = 0;
+constexpr u8 CHANNEL_SNAPSHOT = 1;
+constexpr u8 CHANNEL_MAP = 2;
+constexpr u8 CHANNEL_INPUT = 3;
+constexpr size_t CHANNEL_COUNT = 4;
+
+/// Sent as the data of an ENet disconnect, so the client can show why it was disconnected
+enum class DisconnectReason : u32
+{
+    None,
+    ServerFull,
 };
 
 template <typename E>
 concept NetworkMessageType =
     std::is_same_v<E, ToServerMessageType> || std::is_same_v<E, ToClientMessage>;
 
-template <NetworkMessageType MessageType>
-struct NetworkMessage
+/// Every message starts with its type
+constexpr int MESSAGE_TYPE_BITS = 8;
+
+namespace detail
+{
+    template <typename Class, typename Type>
+    Type member_type(Type Class::*);
+
+    template <auto Member>
+    using MemberType = decltype(member_type(Member));
+
+    template <typename T>
+    consteval int default_field_bits()
+    {
+        if constexpr (std::is_same_v<T, bool>)
+        {
+            return 1;
+        }
+        else if constexpr (std::is_same_v<T, std::string>)
+        {
+            return 0;
+        }
+        else
+        {
+            return sizeof(T) * 8;
+        }
+    }
+} // namespace detail
+
+/// A field of a message, written with `Bits` bits which defaults to the full size of the type.
+/// Strings are written as a varint length followed by the characters, so have no fixed size
+template <auto Member, int Bits = detail::default_field_bits<detail::MemberType<Member>>()>
+struct Field
+{
+    using Type = detail::MemberType<Member>;
+    static constexpr auto MEMBER = Member;
+    static constexpr int BITS = Bits;
+    static constexpr bool FIXED_SIZE = !std::is_same_v<Type, std::string>;
+
+    static_assert(FIXED_SIZE || BITS == 0, "Strings can not be given a bit width");
+    static_assert(!FIXED_SIZE || (BITS > 0 && BITS <= 32 && BITS <= sizeof(Type) * 8),
+                  "Fields are written with at most 32 bits, and no more than the size of the type");
+    static_assert(!std::is_floating_point_v<Type> || BITS == 32, "Floats must be 32 bits");
+};
+
+/// A message declares its type, and lists its fields once in `fields()` as a tuple of Field. The
+/// encoding and decoding, and the sizes of messages, are then all generated from that list
+template <typename T>
+concept NetworkMessageStruct = NetworkMessageType<std::remove_cvref_t<decltype(T::TYPE)>> &&
+                               requires { T::fields(); };
+
+/// If none of the fields of the message are strings
+template <NetworkMessageStruct Message>
+constexpr bool HAS_FIXED_SIZE = std::apply([](auto... fields)
+                                           { return (decltype(fields)::FIXED_SIZE && ...); },
+                                           Message::fields());
+
+/// Bits taken by the fields of a message, other than strings
+template <NetworkMessageStruct Message>
+constexpr size_t FIXED_BITS = std::apply([](auto... fields)
+                                         { return (size_t{0} + ... + decltype(fields)::BITS); },
+                                         Message::fields());
+
+namespace detail
+{
+    template <typename F, typename Message>
+    void write_field(BitWriter& writer, const Message& message)
+    {
+        const auto& value = message.*F::MEMBER;
+        using Type = typename F::Type;
+        if constexpr (std::is_same_v<Type, std::string>)
+        {
+            writer.write_varint(static_cast<u32>(value.size()));
+            for (auto c : value)
+            {
+                writer.write(static_cast<u8>(c), 8);
+            }
+        }
+        else if constexpr (std::is_floating_point_v<Type>)
+        {
+            writer.write(std::bit_cast<u32>(value), 32);
+        }
+        else if constexpr (std::is_enum_v<Type>)
+        {
+            writer.write(static_cast<u32>(std::to_underlying(value)), F::BITS);
+        }
+        else
+        {
+            // Signed values are written as two's complement, and sign extended when read
+            writer.write(static_cast<u32>(value), F::BITS);
+        }
+    }
+
+    template <typename F, typename Message>
+    void read_field(BitReader& reader, Message& message)
+    {
+        auto& value = message.*F::MEMBER;
+        using Type = typename F::Type;
+        if constexpr (std::is_same_v<Type, std::string>)
+        {
+            // The length is not trusted, the string only grows as far as there is data
+            auto length = reader.read_varint();
+            value.clear();
+            value.reserve(std::min<size_t>(length, reader.remaining_bits() / 8));
+            for (u32 i = 0; i < length && reader.is_valid(); i++)
+            {
+                value.push_back(static_cast<char>(reader.read(8)));
+            }
+        }
+        else if constexpr (std::is_floating_point_v<Type>)
+        {
+            value = std::bit_cast<Type>(reader.read(32));
+        }
+        else if constexpr (std::is_same_v<Type, bool>)
+        {
+            value = reader.read(F::BITS) != 0;
+        }
+        else if constexpr (std::is_enum_v<Type>)
+        {
+            value = static_cast<Type>(reader.read(F::BITS));
+        }
+        else if constexpr (std::is_signed_v<Type>)
+        {
+            auto bits = reader.read(F::BITS);
+            if constexpr (F::BITS < 32)
+            {
+                if (bits & (1u << (F::BITS - 1)))
+                {
+                    bits |= ~0u << F::BITS;
+                }
+            }
+            value = static_cast<Type>(static_cast<i32>(bits));
+        }
+        else
+        {
+            value = static_cast<Type>(reader.read(F::BITS));
+        }
+    }
+} // namespace detail
+
+/// Bits taken by the message, not including its type
+template <NetworkMessageStruct Message>
+[[nodiscard]] size_t encoded_bits(const Message& message)
+{
+    if constexpr (HAS_FIXED_SIZE<Message>)
+    {
+        return FIXED_BITS<Message>;
+    }
+    else
+    {
+        auto string_bits = [&]<typename F>(F)
+        {
+            if constexpr (F::FIXED_SIZE)
+            {
+                return size_t{0};
+            }
+            else
+            {
+                auto length = static_cast<u32>((message.*F::MEMBER).size());
+                return BitWriter::varint_bits(length) + size_t{length} * 8;
+            }
+        };
+        return std::apply([&](auto... fields) { return (FIXED_BITS<Message> + ... +
+                                                        string_bits(fields)); },
+                          Message::fields());
+    }
+}
+
+template <NetworkMessageStruct Message>
+void write_message(BitWriter& writer, const Message& message)
+{
+    writer.write(static_cast<u32>(Message::TYPE), MESSAGE_TYPE_BITS);
+    std::apply([&](auto... fields)
+               { (detail::write_field<decltype(fields)>(writer, message), ...); },
+               Message::fields());
+}
+
+/// Reads the fields of the message, after its type has been read
+template <NetworkMessageStruct Message>
+[[nodiscard]] std::optional<Message> read_message(BitReader& reader)
 {
-    NetworkMessage(MessageType message_type) noexcept
+    // Fixed size messages are checked up front, so a short packet is rejected before any reads
+    if constexpr (HAS_FIXED_SIZE<Message>)
     {
-        uint16_t message = static_cast<uint16_t>(message_type);
-        payload << message;
+        if (reader.remaining_bits() < FIXED_BITS<Message>)
+        {
+            return std::nullopt;
+        }
     }
 
-    NetworkMessage(ENetPacket* enet_packet) noexcept
+    Message message;
+    std::apply([&](auto... fields)
+               { (detail::read_field<decltype(fields)>(reader, message), ...); },
+               Message::fields());
+    if (!reader.is_valid())
+    {
+        return std::nullopt;
+    }
+    return message;
+}
+
+/// Owns an ENet packet while it is being written, so messages are written straight into the buffer
+/// that is sent rather than being copied into it
+class PacketWriter
+{
+  public:
+    explicit PacketWriter(size_t capacity);
+    ~PacketWriter();
+
+    PacketWriter(PacketWriter&& other) noexcept;
+    PacketWriter& operator=(PacketWriter&& other) noexcept;
+    PacketWriter(const PacketWriter&) = delete;
+    PacketWriter& operator=(const PacketWriter&) = delete;
+
+    BitWriter& stream();
+
+    /// Hands the packet over to ENet trimmed to the bytes written, after which the writer is empty.
+    /// Returns nullptr if the packet could not be allocated, or a write did not fit in it
+    [[nodiscard]] ENetPacket* release(ENetPacketFlag flags);
+
+  private:
+    ENetPacket* packet_ = nullptr;
+    BitWriter stream_;
+};
+
+/// Writes the message into a new ENet packet, sized to fit it exactly
+template <NetworkMessageStruct Message>
+[[nodiscard]] ENetPacket* to_enet_packet(const Message& message,
+                                         ENetPacketFlag flags = ENET_PACKET_FLAG_RELIABLE)
+{
+    PacketWriter packet((MESSAGE_TYPE_BITS + encoded_bits(message) + 7) / 8);
+    write_message(packet.stream(), message);
+    return packet.release(flags);
+}
+
+/// A message that has been received. It is read in place from the packet, so must be done with
+/// before the packet is destroyed
+template <NetworkMessageType MessageType>
+struct NetworkMessageReader
+{
+    explicit NetworkMessageReader(const ENetPacket* enet_packet) noexcept
     {
         if (enet_packet)
         {
-            payload.append(enet_packet->data, enet_packet->dataLength);
-            uint16_t message;
-            payload >> message;
-            message_type = static_cast<MessageType>(message);
+            stream = {enet_packet->data, enet_packet->dataLength};
+            auto type = stream.read(MESSAGE_TYPE_BITS);
+            if (stream.is_valid())
+            {
+                message_type = static_cast<MessageType>(type);
+            }
         }
     }
 
-    ENetPacket* to_enet_packet(ENetPacketFlag flags = ENET_PACKET_FLAG_RELIABLE) const noexcept
+    /// Reads the fields of a message, which should be the struct for `message_type`
+    template <NetworkMessageStruct Message>
+    [[nodiscard]] std::optional<Message> read()
     {
-        return enet_packet_create(payload.getData(), payload.getDataSize(), flags);
+        static_assert(std::is_same_v<std::remove_cvref_t<decltype(Message::TYPE)>, MessageType>,
+                      "The message is not sent in this direction");
+        return read_message<Message>(stream);
     }
 
-    sf::Packet payload;
+    BitReader stream;
     MessageType message_type = MessageType::None;
 };
 
-using ToServerNetworkMessage = NetworkMessage<ToServerMessageType>;
-using ToClientNetworkMessage = NetworkMessage<ToClientMessage>;
\ No newline at end of file
+using ToServerMessageReader = NetworkMessageReader<ToServerMessageType>;
+using ToClientMessageReader = NetworkMessageReader<ToClientMessage>;
+
+// Messages
+
+/// Chat text. Clients send it to the server, which then sends it on to every client
+template <auto MessageType>
+struct ChatMessage
+{
+    static constexpr auto TYPE = MessageType;
+
+    std::string text;
+
+    static constexpr auto fields()
+    {
+        return std::tuple{Field<&ChatMessage::text>{}};
+    }
+};
+using ToServerChatMessage = ChatMessage<ToServerMessageType::Message>;
+using ToClientChatMessage = ChatMessage<ToClientMessage::Message>;
+
+/// Bits needed for the InputKeyPress flags
+constexpr int INPUT_KEY_BITS = 4;
+static_assert(InputKeyPress::D < 1 << INPUT_KEY_BITS);
+
+/// Most inputs sent in one InputMessage. Enough to cover the frames between sends at high frame
+/// rates, with room to resend the ones that are still waiting to be simulated
+constexpr int MAX_INPUTS_PER_MESSAGE = 64;
+constexpr int INPUT_COUNT_BITS = 7;
+static_assert(MAX_INPUTS_PER_MESSAGE < 1 << INPUT_COUNT_BITS);
+
+/// Inputs are sent with their frame time in steps of a tenth of a millisecond
+constexpr float INPUT_DT_STEP = 0.0001f;
+
+/// Rounds a frame time to the steps it is sent in. The client predicts with the rounded time, so
+/// it simulates exactly what the server does
+[[nodiscard]] u16 quantize_input_dt(float dt);
+[[nodiscard]] float dequantize_input_dt(u16 steps);
+
+/// Sent unreliably at the input send rate of the client, with every input the server has not yet
+/// simulated (up to MAX_INPUTS_PER_MESSAGE), so the inputs of the frames since the last send go in
+/// one packet, and an input in a lost packet arrives with the next one rather than waiting on a
+/// resend. The inputs follow the message, oldest first, see write_input_message
+struct InputMessage
+{
+    static constexpr auto TYPE = ToServerMessageType::Input;
+
+    /// Sequence of the first input, the rest follow on from it
+    u32 first_sequence = 0;
+    u8 count = 0;
+
+    /// The latest complete snapshot the client has, to use as the baseline for its next snapshot
+    u32 acked_snapshot = 0;
+
+    static constexpr auto fields()
+    {
+        return std::tuple{Field<&InputMessage::first_sequence>{},
+                          Field<&InputMessage::count, INPUT_COUNT_BITS>{},
+                          Field<&InputMessage::acked_snapshot>{}};
+    }
+};
+
+/// Writes an InputMessage with the inputs, which must have consecutive sequences. The keys are run
+/// length encoded, as they are usually held for many frames in a row, and each frame time is
+/// written as a varint of the change from the one before
+[[nodiscard]] ENetPacket* write_input_message(std::span<const Input> inputs, u32 acked_snapshot);
+
+/// Reads the inputs that follow an InputMessage into `inputs`, which has room for
+/// MAX_INPUTS_PER_MESSAGE. Returns the number read, or nullopt if the message is malformed
+[[nodiscard]] std::optional<int> read_input_message(ToServerMessageReader& message,
+                                                    std::span<Input, MAX_INPUTS_PER_MESSAGE> inputs,
+                                                    u32& acked_snapshot);
+
+/// Sent to a client when it connects. The number of player slots and NPCs are chosen by the server,
+/// so the client must size its entity array to match the snapshots. The size of the map in tiles
+/// sets how positions in snapshots are quantized
+struct ClientInfoMessage
+{
+    static constexpr auto TYPE = ToClientMessage::ClientInfo;
+
+    i16 id = 0;
+    u16 max_clients = 0;
+    u16 entity_count = 0;
+    u16 map_width = 0;
+    u16 map_height = 0;
+
+    static constexpr auto fields()
+    {
+        return std::tuple{Field<&ClientInfoMessage::id>{}, Field<&ClientInfoMessage::max_clients>{},
+                          Field<&ClientInfoMessage::entity_count>{},
+                          Field<&ClientInfoMessage::map_width>{},
+                          Field<&ClientInfoMessage::map_height>{}};
+    }
+};
+
+struct PlayerJoinMessage
+{
+    static constexpr auto TYPE = ToClientMessage::PlayerJoin;
+
+    static constexpr auto fields()
+    {
+        return std::tuple{};
+    }
+};
+
+struct PlayerLeaveMessage
+{
+    static constexpr auto TYPE = ToClientMessage::PlayerLeave;
+
+    static constexpr auto fields()
+    {
+        return std::tuple{};
+    }
+};
+
+/// The header of each part of a snapshot, the bit packed entity records follow it
+struct SnapshotMessage
+{
+    static constexpr auto TYPE = ToClientMessage::Snapshot;
+
+    u32 sequence = 0;
+
+    /// The snapshot the records are a delta against, 0 when there is no baseline
+    u32 baseline = 0;
+
+    u16 entity_count = 0;
+    u16 part = 0;
+    u16 part_count = 0;
+    u16 record_count = 0;
+
+    static constexpr auto fields()
+    {
+        return std::tuple{Field<&SnapshotMessage::sequence>{}, Field<&SnapshotMessage::baseline>{},
+                          Field<&SnapshotMessage::entity_count>{},
+                          Field<&SnapshotMessage::part>{}, Field<&SnapshotMessage::part_count>{},
+                          Field<&SnapshotMessage::record_count>{}};
+    }
+};
+
+/// A piece of the map manifest. The hashes of `count` chunks from `first_chunk` on follow, each as
+/// two 32 bit halves. The map channel is not ordered with the ClientInfo, so each piece also says
+/// how big the map is, and the piece with the first chunk starts the map on the client
+struct MapManifestMessage
+{
+    static constexpr auto TYPE = ToClientMessage::MapManifest;
+
+    u16 map_width = 0;
+    u16 map_height = 0;
+    u32 first_chunk = 0;
+    u32 count = 0;
+
+    static constexpr auto fields()
+    {
+        return std::tuple{Field<&MapManifestMessage::map_width>{},
+                          Field<&MapManifestMessage::map_height>{},
+                          Field<&MapManifestMessage::first_chunk>{},
+                          Field<&MapManifestMessage::count>{}};
+    }
+};
+
+/// The chunks of the map the client does not have. The indices follow in ascending order, each as
+/// a varint of the gap from the one before
+struct MapChunkRequestMessage
+{
+    static constexpr auto TYPE = ToServerMessageType::MapChunkRequest;
+
+    u32 count = 0;
+
+    static constexpr auto fields()
+    {
+        return std::tuple{Field<&MapChunkRequestMessage::count>{}};
+    }
+};
+
+/// A chunk of the map, the tiles of which follow the message
+struct MapChunkMessage
+{
+    static constexpr auto TYPE = ToClientMessage::MapChunk;
+
+    u32 index = 0;
+
+    static constexpr auto fields()
+    {
+        return std::tuple{Field<&MapChunkMessage::index>{}};
+    }
+};
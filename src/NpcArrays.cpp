@@ -0,0 +1,211 @@
+#include "NpcArrays.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "CollisionMap.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NPC_STEERING_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    /// Most entities near each NPC checked for overlap in a tick. There can be more NPCs than fit
+    /// on the map, so they end up in piles, and checking every NPC of a pile against the rest would
+    /// be O(n^2). Every pair found pushes both NPCs apart equally, so a pile still spreads out
+    constexpr int MAX_SEPARATION_NEIGHBOURS = 32;
+
+    /// One NPC at a time, used when SSE2 is not available and for the NPCs left over after the
+    /// groups of 4. The results are identical, as SSE2 square root and division round the same way
+    void steer_npc(NpcArrays& npcs, sf::Vector2f target, int i)
+    {
+        auto diff_x = target.x - npcs.position_x[i];
+        auto diff_y = target.y - npcs.position_y[i];
+
+        auto len = std::sqrt(diff_x * diff_x + diff_y * diff_y);
+        if (len == 0)
+        {
+            len = 1;
+        }
+
+        sf::Vector2f velocity{npcs.velocity_x[i] + diff_x / len * npcs.acceleration[i],
+                              npcs.velocity_y[i] + diff_y / len * npcs.acceleration[i]};
+        damp_velocity(velocity);
+
+        npcs.velocity_x[i] = velocity.x;
+        npcs.velocity_y[i] = velocity.y;
+    }
+
+    /// Sign of the push along an axis. Entities in the same spot are split up by id, so that they
+    /// are pushed opposite ways
+    float separation_direction(float diff, int id, int other_id)
+    {
+        if (diff == 0)
+        {
+            return id < other_id ? -1.0f : 1.0f;
+        }
+        return diff < 0 ? -1.0f : 1.0f;
+    }
+} // namespace
+
+NpcArrays::NpcArrays(int count, int first_id)
+    : first_id(first_id)
+    , position_x(count)
+    , position_y(count)
+    , velocity_x(count)
+    , velocity_y(count)
+    , acceleration(count)
+    , is_grounded(count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        acceleration[i] = 2.0f + static_cast<float>(first_id + i) / 100.0f;
+    }
+}
+
+int NpcArrays::size() const
+{
+    return static_cast<int>(position_x.size());
+}
+
+void steer_npcs(NpcArrays& npcs, sf::Vector2f target, int begin, int end)
+{
+    int i = begin;
+
+#ifdef NPC_STEERING_SSE2
+    const auto target_x = _mm_set1_ps(target.x);
+    const auto target_y = _mm_set1_ps(target.y);
+    const auto zero = _mm_setzero_ps();
+    const auto one = _mm_set1_ps(1.0f);
+    const auto max_speed = _mm_set1_ps(MAX_SPEED);
+    const auto min_speed = _mm_set1_ps(-MAX_SPEED);
+    const auto horizontal_damping = _mm_set1_ps(HORIZONTAL_DAMPING);
+    const auto vertical_damping = _mm_set1_ps(VERTICAL_DAMPING);
+
+    for (; i + 4 <= end; i += 4)
+    {
+        auto diff_x = _mm_sub_ps(target_x, _mm_loadu_ps(&npcs.position_x[i]));
+        auto diff_y = _mm_sub_ps(target_y, _mm_loadu_ps(&npcs.position_y[i]));
+
+        // Select 1 for the lengths that are 0, so NPCs already on the target do not divide by 0
+        auto len = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(diff_x, diff_x), _mm_mul_ps(diff_y, diff_y)));
+        auto is_zero = _mm_cmpeq_ps(len, zero);
+        len = _mm_or_ps(_mm_and_ps(is_zero, one), _mm_andnot_ps(is_zero, len));
+
+        auto acceleration = _mm_loadu_ps(&npcs.acceleration[i]);
+        auto velocity_x = _mm_add_ps(_mm_loadu_ps(&npcs.velocity_x[i]),
+                                     _mm_mul_ps(_mm_div_ps(diff_x, len), acceleration));
+        auto velocity_y = _mm_add_ps(_mm_loadu_ps(&npcs.velocity_y[i]),
+                                     _mm_mul_ps(_mm_div_ps(diff_y, len), acceleration));
+
+        velocity_x = _mm_min_ps(_mm_max_ps(velocity_x, min_speed), max_speed);
+        velocity_y = _mm_min_ps(_mm_max_ps(velocity_y, min_speed), max_speed);
+        _mm_storeu_ps(&npcs.velocity_x[i], _mm_mul_ps(velocity_x, horizontal_damping));
+        _mm_storeu_ps(&npcs.velocity_y[i], _mm_mul_ps(velocity_y, vertical_damping));
+    }
+#endif
+
+    for (; i < end; i++)
+    {
+        steer_npc(npcs, target, i);
+    }
+}
+
+void find_separation_pushes(const NpcArrays& npcs, std::span<const SeparationBody> bodies,
+                            const SpatialGrid& grid, float query_radius, int begin, int end,
+                            std::vector<SeparationPush>& pushes)
+{
+    for (int i = begin; i < end; i++)
+    {
+        auto id = npcs.first_id + i;
+        const auto& body = bodies[id];
+
+        // Every entry visited counts towards the cap, so a dense crowd costs no more than this
+        int visited = 0;
+        grid.visit_radius(
+            body.centre, query_radius,
+            [&](const SpatialGridEntry& entry)
+            {
+                auto other_id = entry.id;
+                auto is_npc = other_id >= npcs.first_id;
+                if (other_id == id || (is_npc && other_id < id))
+                {
+                    return ++visited < MAX_SEPARATION_NEIGHBOURS;
+                }
+
+                const auto& other = bodies[other_id];
+                auto diff = body.centre - other.centre;
+                sf::Vector2f overlap{body.half_size.x + other.half_size.x - std::abs(diff.x),
+                                     body.half_size.y + other.half_size.y - std::abs(diff.y)};
+                if (overlap.x > 0 && overlap.y > 0)
+                {
+                    // Pushed out along the axis that overlaps the least, which is the shortest way
+                    // out
+                    auto share = is_npc ? 0.5f : 1.0f;
+                    sf::Vector2f push;
+                    if (overlap.x < overlap.y)
+                    {
+                        push.x = separation_direction(diff.x, id, other_id) * overlap.x * share;
+                    }
+                    else
+                    {
+                        push.y = separation_direction(diff.y, id, other_id) * overlap.y * share;
+                    }
+                    pushes.push_back({.npc = i, .other = is_npc ? other_id - npcs.first_id : -1,
+                                      .push = push});
+                }
+                return ++visited < MAX_SEPARATION_NEIGHBOURS;
+            });
+    }
+}
+
+void apply_separation_pushes(NpcArrays& npcs, std::span<const SeparationPush> pushes)
+{
+    for (const auto& [npc, other, push] : pushes)
+    {
+        npcs.velocity_x[npc] += push.x;
+        npcs.velocity_y[npc] += push.y;
+        if (other >= 0)
+        {
+            npcs.velocity_x[other] -= push.x;
+            npcs.velocity_y[other] -= push.y;
+        }
+    }
+
+    // Clamped once all the pushes are added, so a crowd can not push an NPC through a tile
+    auto clamp_speed = [&](int i)
+    {
+        npcs.velocity_x[i] = std::clamp(npcs.velocity_x[i], -MAX_SPEED, MAX_SPEED);
+        npcs.velocity_y[i] = std::clamp(npcs.velocity_y[i], -MAX_SPEED, MAX_SPEED);
+    };
+    for (const auto& push : pushes)
+    {
+        clamp_speed(push.npc);
+        if (push.other >= 0)
+        {
+            clamp_speed(push.other);
+        }
+    }
+}
+
+void move_npcs(NpcArrays& npcs, const CollisionMap& map, int begin, int end)
+{
+    for (int i = begin; i < end; i++)
+    {
+        EntityTransform transform{
+            .position = {npcs.position_x[i], npcs.position_y[i]},
+            .size = NPC_SIZE,
+            .velocity = {npcs.velocity_x[i], npcs.velocity_y[i]},
+            .is_grounded = npcs.is_grounded[i] != 0,
+        };
+        move_with_map_collisions(transform, map);
+
+        npcs.position_x[i] = transform.position.x;
+        npcs.position_y[i] = transform.position.y;
+        npcs.velocity_x[i] = transform.velocity.x;
+        npcs.velocity_y[i] = transform.velocity.y;
+        npcs.is_grounded[i] = transform.is_grounded;
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include <SFML/System/Vector2.hpp>
+
+#include "Common.h"
+#include "Util/SpatialGrid.h"
+
+/// All NPCs are the same size
+constexpr sf::Vector2f NPC_SIZE = EntityTransform{}.size;
+
+/// The NPCs on the server, stored as an array for each field rather than as an array of entities.
+/// The steering then reads and writes contiguous floats, so it can be run on several NPCs at once
+/// with SIMD.
+struct NpcArrays
+{
+    /// The NPCs are given the ids following `first_id`, which sets how fast they accelerate
+    NpcArrays(int count, int first_id);
+
+    [[nodiscard]] int size() const;
+
+    /// Entity id of the first NPC
+    int first_id = 0;
+
+    std::vector<float> position_x;
+    std::vector<float> position_y;
+    std::vector<float> velocity_x;
+    std::vector<float> velocity_y;
+
+    /// NPCs with higher ids accelerate faster, so they spread out as they chase
+    std::vector<float> acceleration;
+
+    std::vector<u8> is_grounded;
+};
+
+/// Box of an entity that NPCs are pushed out of. Stored by centre, so boxes of different sizes can
+/// be compared without knowing which is which
+struct SeparationBody
+{
+    sf::Vector2f centre;
+    sf::Vector2f half_size;
+};
+
+/// Accelerates the NPCs in [begin, end) towards the target, then damps their velocity. This is the
+/// same as moving each towards the target then calling damp_velocity, but on 4 NPCs at a time where
+/// SSE2 is available
+void steer_npcs(NpcArrays& npcs, sf::Vector2f target, int begin, int end);
+
+/// An NPC overlapping another entity. The NPC is pushed by `push`, and the other entity by the
+/// opposite if it is an NPC too
+struct SeparationPush
+{
+    int npc = 0;
+    int other = 0;
+    sf::Vector2f push;
+};
+
+/// Appends the pushes of the NPCs in [begin, end) out of the entities they overlap to `pushes`.
+/// `bodies` is indexed by entity id, and `grid` holds the centres of the bodies that take part.
+/// Each pair of NPCs is found once, by the one with the lower id, so the two are pushed apart
+/// equally. Players are not moved by the NPCs, so the NPC takes all of that push. Only the bodies
+/// are read, so ranges can be found in parallel
+void find_separation_pushes(const NpcArrays& npcs, std::span<const SeparationBody> bodies,
+                            const SpatialGrid& grid, float query_radius, int begin, int end,
+                            std::vector<SeparationPush>& pushes);
+
+/// Adds the pushes to the velocities of the NPCs, so the map still blocks them. A push can move
+/// NPCs from any range, so this is not run in parallel
+void apply_separation_pushes(NpcArrays& npcs, std::span<const SeparationPush> pushes);
+
+/// Moves the NPCs in [begin, end) by their velocity, colliding with the map and applying gravity
+void move_npcs(NpcArrays& npcs, const CollisionMap& map, int begin, int end);
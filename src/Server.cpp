@@ -1,43 +1,56 @@
 #include "Server.h"
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
 #include <print>
-#include <ranges>
 
 #include "NetworkMessage.h"
 
-#include "Util/Util.h"
+#include "Util/TimeStep.h"
 
 namespace
 {
-    void reset_player_peer(ENetPeer* peer)
+    /// NPCs simulated by each job. A multiple of 4 so the SIMD steering is never split
+    constexpr int NPC_JOB_SIZE = 1024;
+
+    ServerConfig validate_config(ServerConfig config)
     {
-        if (!peer)
+        config.max_clients = std::clamp(config.max_clients, 1, MAX_PLAYER_CAPACITY);
+        config.npc_count =
+            std::clamp(config.npc_count, 0, std::numeric_limits<i16>::max() - config.max_clients);
+        if (!(config.interest_radius > 0))
         {
-            return;
+            config.interest_radius = DEFAULT_INTEREST_RADIUS;
         }
-
-        auto player = (ServerEntity*)peer->data;
-        if (player)
+        config.map_tiles = std::clamp(config.map_tiles, 1, MAX_MAP_TILES);
+        if (config.worker_threads < 0)
         {
-            player->peer = nullptr;
-            player->common.active = false;
+            config.worker_threads =
+                std::max(static_cast<int>(std::thread::hardware_concurrency()) - 1, 0);
         }
-        peer->data = nullptr;
+        return config;
     }
 } // namespace
 
-Server::Server()
+Server::Server(const ServerConfig& config)
+    : config_(validate_config(config))
+    , map_(config_.map_path.empty() ? make_built_in_map(config_.map_tiles, config_.map_tiles)
+                                    : CollisionMap(0, 0))
+    , position_quantizer_(std::max(map_.width(), map_.height()))
+    , player_slots_(config_.max_clients)
+    , players_(config_.max_clients)
+    , peer_players_(config_.max_clients + REFUSAL_PEER_COUNT, -1)
+    , npcs_(config_.npc_count, config_.max_clients)
+    , separation_bodies_(config_.max_clients + config_.npc_count)
+    , separation_grid_(SEPARATION_GRID_CELL_SIZE)
+    , interest_grid_(INTEREST_GRID_CELL_SIZE)
+    , client_interests_(config_.max_clients)
 {
-    for (int i = 0; i < entities_.size(); i++)
+    for (int i = 0; i < config_.max_clients; i++)
     {
-        entities_[i].common.id = i;
-        entities_[i].common.active = i >= MAX_CLIENTS;
-
-        if (i < MAX_CLIENTS)
-        {
-            entities_[i].common.transform.size = {24, 48};
-        }
+        players_[i].common.id = i;
+        players_[i].common.transform.size = PLAYER_SIZE;
     }
 }
 
@@ -48,191 +61,384 @@ Server::~Server()
 
 bool Server::run()
 {
-    ENetAddress address = {.host = ENET_HOST_ANY, .port = 12345, .sin6_scope_id = 0};
-    server_ = enet_host_create(&address, MAX_CLIENTS, 2, 0, 0);
+    // The map file is mapped rather than read, so this is quick however big the map is
+    if (!config_.map_path.empty())
+    {
+        auto map = CollisionMap::load(config_.map_path);
+        if (!map)
+        {
+            std::println("Failed to load the map file '{}'.", config_.map_path);
+            return false;
+        }
+        map_ = std::move(*map);
+        position_quantizer_ = PositionQuantizer(std::max(map_.width(), map_.height()));
+    }
+    chunk_hashes_ = map_.chunk_hashes();
 
-    if (!server_)
+    if (!network_.start(config_.port, peer_players_.size(), map_.chunk_count()))
     {
         std::println("An error occurred while trying to create an ENet server host.");
         return false;
     }
+    jobs_.emplace(config_.worker_threads);
+
+    std::println("[Server] Listening on port {} at {} ticks per second with {} player slots and {} "
+                 "NPCs, interest radius {}, {} worker threads, {}x{} tile map",
+                 config_.port, config_.tick_rate, config_.max_clients, config_.npc_count,
+                 config_.interest_radius, jobs_->worker_count(), map_.width(), map_.height());
 
+    running_ = true;
     server_thread_ = std::jthread([&] { launch(); });
     return true;
 }
 
 void Server::launch()
 {
-    int ticks = 0;
-    running_ = true;
+    TimeStep time_step{config_.tick_rate, MAX_CATCH_UP_TICKS};
+    auto ticks_per_second = static_cast<u64>(std::max(config_.tick_rate, 1.0f));
+    u64 last_report = 0;
+
     while (running_)
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds((int)SERVER_TPS));
+        auto ticks_due = time_step.wait_for_ticks();
 
-        if (++ticks % 20 == 0)
+        handle_events();
+        for (int i = 0; i < ticks_due; i++)
         {
-            std::println("[Server] Ticks: {} ({} seconds)", ticks, ticks / 20);
+            tick();
         }
 
-        ENetEvent event;
-        while (enet_host_service(server_, &event, 0) > 0)
-        {
-            switch (event.type)
-            {
-                case ENET_EVENT_TYPE_CONNECT:
-                {
-
-                    // Host -> event.peer->address.host
-                    // Port -> event.peer->address.port
-                    std::println("[Server] A new client connected.");
-                    i16 id = 0;
-                    for (int i = 0; i < MAX_CLIENTS; i++)
-                    {
-                        if (!entities_[i].peer)
-                        {
-                            id = entities_[i].common.id;
-                            entities_[i].peer = event.peer;
-                            entities_[i].common.active = true;
-                            event.peer->data = (void*)&entities_[i];
-                            std::println("[Server] New client slot: {}",
-                                         (int)entities_[i].common.id);
-                            break;
-                        }
-                    }
-                    ToClientNetworkMessage client_id{ToClientMessage::ClientInfo};
-                    client_id.payload << id;
-                    enet_peer_send(event.peer, 0, client_id.to_enet_packet());
-
-                    ToClientNetworkMessage outgoing_message{ToClientMessage::PlayerJoin};
-                    enet_host_broadcast(server_, 0, outgoing_message.to_enet_packet());
-                }
-                break;
-
-                case ENET_EVENT_TYPE_RECEIVE:
-                {
-                    ToServerNetworkMessage incoming_message{event.packet};
-                    switch (incoming_message.message_type)
-                    {
-                        case ToServerMessageType::Message:
-                        {
-                            std::string text;
-                            incoming_message.payload >> text;
-                            std::println("[Server] Got message from client: ", text);
-
-                            ToClientNetworkMessage outgoing_message{ToClientMessage::Message};
-                            outgoing_message.payload << text;
-                            enet_host_broadcast(server_, 0, outgoing_message.to_enet_packet());
-                            enet_host_flush(server_);
-                        }
-                        break;
-
-                        case ToServerMessageType::Input:
-                        {
-                            Input input;
-                            auto player = (ServerEntity*)event.peer->data;
-
-                            incoming_message.payload >> player->last_processed >> input.dt >>
-                                input.keys;
-
-                            // std::println("Got input {} {} from player {}", input.keys, input.dt,
-                            // player->common.id);
-
-                            player->input_buffer.push_back(input);
-
-                            // TODO - rather than process input straight away...
-                            // process_input_for_player(player->common.transform, input);
-                        }
-                        break;
-
-                        default:
-                            break;
-                    }
-                    enet_packet_destroy(event.packet);
-                }
-                break;
+        // Only the latest state is sent, ticks run to catch up do not need their own snapshot
+        send_snapshots();
+        send_map_chunks();
+        time_step.end_ticks();
 
-                case ENET_EVENT_TYPE_DISCONNECT:
-                {
-                    std::println("[Server] Client has disconnected.");
-                    reset_player_peer(event.peer);
-                    ToClientNetworkMessage outgoing_message{ToClientMessage::PlayerLeave};
-                    enet_host_broadcast(server_, 0, outgoing_message.to_enet_packet());
-                }
-                break;
+        const auto& stats = time_step.stats();
+        if (stats.ticks - last_report >= ticks_per_second)
+        {
+            last_report = stats.ticks;
+            std::println("[Server] Ticks: {} ({} seconds) Overruns: {} Skipped: {} Avg: {:.2f}ms "
+                         "Max: {:.2f}ms",
+                         stats.ticks, stats.ticks / ticks_per_second,
+                         stats.overruns, stats.skipped_ticks,
+                         stats.total_work_time.count() / 1000.0 / stats.ticks,
+                         stats.longest_work_time.count() / 1000.0);
+        }
+    }
+}
 
-                case ENET_EVENT_TYPE_DISCONNECT_TIMEOUT:
-                {
-                    std::println("[Server] Client has timed-out.");
-                    reset_player_peer(event.peer);
-                    ToClientNetworkMessage outgoing_message{ToClientMessage::PlayerLeave};
-                    enet_host_broadcast(server_, 0, outgoing_message.to_enet_packet());
-                }
-                break;
+void Server::handle_events()
+{
+    while (auto event = network_.poll())
+    {
+        const auto& peer = event->peer;
+        if (std::holds_alternative<ConnectEvent>(event->data))
+        {
+            std::println("[Server] A new client connected.");
+            auto slot = player_slots_.acquire();
+            if (!slot)
+            {
+                // The peer is only kept long enough for it to be told why it is disconnected
+                std::println("[Server] Refused client, all {} player slots are in use.",
+                             player_slots_.capacity());
+                network_.disconnect(peer, DisconnectReason::ServerFull);
+                continue;
+            }
 
-                default:
-                    break;
+            auto& player = players_[*slot];
+            player.peer = peer;
+            player.common.active = true;
+            peer_players_[peer.index] = *slot;
+            std::println("[Server] New client slot: {} ({}/{} in use)", *slot,
+                         player_slots_.in_use(), player_slots_.capacity());
+
+            ClientInfoMessage client_info{
+                .id = player.common.id,
+                .max_clients = static_cast<u16>(config_.max_clients),
+                .entity_count = static_cast<u16>(config_.max_clients + npcs_.size()),
+                .map_width = static_cast<u16>(map_.width()),
+                .map_height = static_cast<u16>(map_.height()),
+            };
+            network_.send(peer, CHANNEL_RELIABLE, to_enet_packet(client_info));
+            network_.broadcast(CHANNEL_RELIABLE, to_enet_packet(PlayerJoinMessage{}));
+
+            // The client asks for the chunks it does not already have once it has the manifest
+            player.map_sender.start();
+        }
+        else if (auto disconnect = std::get_if<DisconnectEvent>(&event->data))
+        {
+            if (disconnect->timed_out)
+            {
+                std::println("[Server] Client has timed-out.");
+            }
+            else
+            {
+                std::println("[Server] Client has disconnected.");
+            }
+            if (remove_player(peer))
+            {
+                network_.broadcast(CHANNEL_RELIABLE, to_enet_packet(PlayerLeaveMessage{}));
             }
         }
-
-        for (int i = 0; i < MAX_CLIENTS; i++)
+        else if (auto message = std::get_if<ToServerChatMessage>(&event->data))
+        {
+            std::println("[Server] Got message from client: {}", message->text);
+            network_.broadcast(
+                CHANNEL_RELIABLE,
+                to_enet_packet(ToClientChatMessage{.text = std::move(message->text)}));
+        }
+        else if (auto input = std::get_if<InputEvent>(&event->data))
         {
-            auto& player = entities_[i];
-            if (!player.common.active)
+            // Simulated by the following ticks, within the player's budget
+            if (auto player = find_player(peer))
             {
-
-                continue;
+                player->input_buffer.push(input->input);
             }
-            for (const auto& input : player.input_buffer)
+        }
+        else if (auto ack = std::get_if<SnapshotAckEvent>(&event->data))
+        {
+            if (auto player = find_player(peer))
             {
-                // prevent dts above 60!
-                if (input.dt <= 0.16)
-                {
-                    process_input_for_player(player.common.transform, input);
-                    apply_map_collisions(player.common.transform);
-                }
+                player->acked_snapshot = ack->sequence;
             }
-
-            if (player.input_buffer.empty())
+        }
+        else if (auto request = std::get_if<MapRequestEvent>(&event->data))
+        {
+            if (auto player = find_player(peer))
             {
-                std::println("No player input to process.");
-                apply_map_collisions(player.common.transform);
+                player->map_sender.request(request->chunks, map_,
+                                           player->common.transform.position);
             }
-            player.input_buffer.clear();
+        }
+    }
+}
+
+void Server::tick()
+{
+    auto tick_time = 1.0f / config_.tick_rate;
+    for (int i = 0; i < config_.max_clients; i++)
+    {
+        auto& player = players_[i];
+        if (!player.common.active)
+        {
+
+            continue;
+        }
+
+        // Only as much input as the tick is long is simulated, however many inputs have arrived
+        bool processed = false;
+        player.input_buffer.begin_tick(tick_time);
+        while (auto input = player.input_buffer.pop())
+        {
+            process_input_for_player(player.common.transform, *input);
+            apply_map_collisions(player.common.transform, map_);
+            player.last_processed = input->sequence;
+            processed = true;
         }
 
-        for (auto& entity : entities_ | std::ranges::views::drop(MAX_CLIENTS))
+        // The player still falls while its inputs are held back
+        if (!processed)
         {
-            auto& entity_transform = entity.common.transform;
-            auto& player_position = entities_[0].common.transform.position;
+            apply_map_collisions(player.common.transform, map_);
+        }
+    }
 
-            auto diff = player_position - entity_transform.position;
+    // The NPCs are pushed out of each other and the players, found with a grid of where everything
+    // is before the NPCs move. Inactive players are left out of the grid
+    std::vector<SpatialGridEntry> grid_entries;
+    grid_entries.reserve(separation_bodies_.size());
+    for (const auto& player : players_)
+    {
+        const auto& transform = player.common.transform;
+        auto centre = transform.position + transform.size / 2.0f;
+        separation_bodies_[player.common.id] = {.centre = centre,
+                                                .half_size = transform.size / 2.0f};
+        if (player.common.active)
+        {
+            grid_entries.push_back({.id = player.common.id, .position = centre});
+        }
+    }
+    for (int i = 0; i < npcs_.size(); i++)
+    {
+        auto id = npcs_.first_id + i;
+        sf::Vector2f centre{npcs_.position_x[i] + NPC_SIZE.x / 2,
+                            npcs_.position_y[i] + NPC_SIZE.y / 2};
+        separation_bodies_[id] = {.centre = centre, .half_size = NPC_SIZE / 2.0f};
+        grid_entries.push_back({.id = id, .position = centre});
+    }
+    separation_grid_.build(grid_entries);
+
+    // Furthest apart the centres of an NPC and an entity it overlaps can be
+    auto separation_radius =
+        std::hypot((NPC_SIZE.x + PLAYER_SIZE.x) / 2, (NPC_SIZE.y + PLAYER_SIZE.y) / 2);
+
+    // The NPCs all chase the first player. Steering only touches each NPC's own elements of the
+    // arrays, and each job keeps the pushes it finds apart, so they can be split across threads
+    // without changing the result
+    auto target = players_[0].common.transform.position;
+    separation_pushes_.resize((npcs_.size() + NPC_JOB_SIZE - 1) / NPC_JOB_SIZE);
+    jobs_->parallel_for(npcs_.size(), NPC_JOB_SIZE,
+                       [&](int begin, int end)
+                       {
+                           auto& pushes = separation_pushes_[begin / NPC_JOB_SIZE];
+                           pushes.clear();
+                           steer_npcs(npcs_, target, begin, end);
+                           find_separation_pushes(npcs_, separation_bodies_, separation_grid_,
+                                                  separation_radius, begin, end, pushes);
+                       });
+
+    // A pair of NPCs can be in different jobs, so the pushes are added once they are all found
+    for (const auto& pushes : separation_pushes_)
+    {
+        apply_separation_pushes(npcs_, pushes);
+    }
+    jobs_->parallel_for(npcs_.size(), NPC_JOB_SIZE,
+                       [&](int begin, int end) { move_npcs(npcs_, map_, begin, end); });
+}
 
-            auto len = std::sqrt(diff.x * diff.x + diff.y * diff.y);
-            auto move = diff / (len == 0 ? 1 : len);
+void Server::send_snapshots()
+{
+    WorldSnapshot snapshot;
+    snapshot.sequence = ++snapshot_sequence_;
+    snapshot.entities.reserve(players_.size() + npcs_.size());
+
+    // Inactive entities (eg empty player slots) are left out of the grid, so they leave the area of
+    // interest of every client
+    std::vector<SpatialGridEntry> grid_entries;
+    grid_entries.reserve(players_.size() + npcs_.size());
+    for (const auto& player : players_)
+    {
+        snapshot.entities.push_back({.position = player.common.transform.position,
+                                     .last_processed = player.last_processed,
+                                     .active = player.common.active});
+        if (player.common.active)
+        {
+            grid_entries.push_back(
+                {.id = player.common.id, .position = player.common.transform.position});
+        }
+    }
+    for (int i = 0; i < npcs_.size(); i++)
+    {
+        sf::Vector2f position{npcs_.position_x[i], npcs_.position_y[i]};
+        snapshot.entities.push_back({.position = position, .active = true});
+        grid_entries.push_back({.id = config_.max_clients + i, .position = position});
+    }
+    interest_grid_.build(grid_entries);
+
+    // Each client is sent the changes to the entities around its player since the last snapshot it
+    // acknowledged, so the size of a snapshot depends on how crowded the area is rather than how
+    // many entities there are. The snapshots of each client are written in parallel, and handed to
+    // the network thread as soon as each is written
+    jobs_->parallel_for(
+        config_.max_clients, 1,
+        [&](int begin, int end)
+        {
+            std::vector<int> nearby;
+            for (int i = begin; i < end; i++)
+            {
+                const auto& player = players_[i];
+                if (!player.peer)
+                {
+                    continue;
+                }
 
-            auto& velocity = entity_transform.velocity;
-            velocity += move * (2.0f + static_cast<float>(entity.common.id) / 100.0f);
+                nearby.clear();
+                interest_grid_.query_radius(player.common.transform.position,
+                                            config_.interest_radius, nearby);
+                std::ranges::sort(nearby);
+                std::vector<u16> interest(nearby.begin(), nearby.end());
 
-            apply_map_collisions(entity_transform);
+                auto& interest_history = client_interests_[i];
+                auto baseline = snapshot_history_.find(player.acked_snapshot);
+                std::span<const u16> baseline_interest;
+                if (auto ids = interest_history.find(player.acked_snapshot))
+                {
+                    baseline_interest = *ids;
+                }
+                else
+                {
+                    baseline = nullptr;
+                }
+
+                // Snapshots are superseded every tick, so they are never resent. Unsequenced as
+                // the client drops any that arrive after a newer one
+                for (auto& packet : write_snapshot(snapshot, interest, baseline, baseline_interest,
+                                                   position_quantizer_))
+                {
+                    network_.send(*player.peer, CHANNEL_SNAPSHOT,
+                                  packet.release(ENET_PACKET_FLAG_UNSEQUENCED));
+                }
+                interest_history.push(snapshot.sequence, std::move(interest));
+            }
+        });
+
+    snapshot_history_.push(std::move(snapshot));
+}
+
+void Server::send_map_chunks()
+{
+    for (auto& player : players_)
+    {
+        if (!player.peer || player.map_sender.is_done())
+        {
+            continue;
         }
 
-        ToClientNetworkMessage snapshot(ToClientMessage::Snapshot);
-        for (const auto& entity : entities_)
+        // The map is held back while the client is behind on acknowledging what it was sent before,
+        // so a slow connection is sent the map only as fast as it can take it
+        auto in_transit = network_.reliable_data_in_transit(*player.peer);
+        if (in_transit >= MAP_STREAM_MAX_IN_TRANSIT)
         {
-            snapshot.payload << entity.common.id << entity.last_processed
-                             << entity.common.transform.position.x
-                             << entity.common.transform.position.y << entity.common.active;
+            continue;
+        }
+        auto budget = std::min<size_t>(MAP_STREAM_BYTES_PER_TICK,
+                                       MAP_STREAM_MAX_IN_TRANSIT - in_transit);
+        for (auto& packet : player.map_sender.write_packets(map_, chunk_hashes_, budget))
+        {
+            network_.send(*player.peer, CHANNEL_MAP, packet.release(ENET_PACKET_FLAG_RELIABLE));
         }
-        enet_host_broadcast(server_, 0, snapshot.to_enet_packet());
     }
 }
 
+ServerEntity* Server::find_player(PeerHandle peer)
+{
+    auto slot = peer_players_[peer.index];
+    if (slot < 0 || players_[slot].peer != peer)
+    {
+        return nullptr;
+    }
+    return &players_[slot];
+}
+
+bool Server::remove_player(PeerHandle peer)
+{
+    auto player = find_player(peer);
+    if (!player)
+    {
+        return false;
+    }
+
+    player->peer.reset();
+    player->common.active = false;
+    player->input_buffer.clear();
+    player->map_sender.clear();
+    player->last_processed = 0;
+    player->acked_snapshot = 0;
+    peer_players_[peer.index] = -1;
+    client_interests_[player->common.id].clear();
+
+    player_slots_.release(player->common.id);
+    return true;
+}
+
 void Server::stop()
 {
-    // enet_host_destroy(server_);
     if (running_)
     {
         running_ = false;
         server_thread_.join();
     }
+
+    // Stopped after the simulation, which may still be queuing packets until then
+    network_.stop();
 }
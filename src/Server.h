@@ -3,33 +3,95 @@
 #include <atomic>
 #include <thread>
 #include <array>
+#include <optional>
+#include <string>
 
 #include <enet/enet.h>
 #include <SFML/System/Vector2.hpp>
 #include <SFML/System/Time.hpp>
 
+#include "CollisionMap.h"
 #include "Common.h"
+#include "InputJitterBuffer.h"
+#include "MapStream.h"
+#include "NpcArrays.h"
+#include "ServerNetwork.h"
+#include "Snapshot.h"
+#include "Util/JobSystem.h"
+#include "Util/SlotAllocator.h"
+#include "Util/SpatialGrid.h"
 
 
-constexpr int MAX_CLIENTS = 4;
-constexpr int MAX_ENTITIES = MAX_CLIENTS * 100;
+constexpr int DEFAULT_MAX_CLIENTS = 4;
+constexpr int DEFAULT_NPC_COUNT = DEFAULT_MAX_CLIENTS * 100 - DEFAULT_MAX_CLIENTS;
 constexpr float SERVER_TICK_RATE = 20;
-constexpr float SERVER_TPS = 1000 / SERVER_TICK_RATE;
+
+/// How many ticks can be run back to back when the server falls behind before ticks are dropped
+constexpr int MAX_CATCH_UP_TICKS = 5;
+
+constexpr u16 DEFAULT_PORT = 12345;
+
+/// Extra ENet peers on top of the player slots, so that connections to a full server can be
+/// accepted just long enough to tell them why they are being disconnected
+constexpr int REFUSAL_PEER_COUNT = 16;
+
+/// Upper limit of player slots, bound by the number of peers an ENet host can have
+constexpr int MAX_PLAYER_CAPACITY = ENET_PROTOCOL_MAXIMUM_PEER_ID - REFUSAL_PEER_COUNT;
+
+/// Clients are only sent the entities within this many pixels of their player. This is a little
+/// over what a 1600x900 window can show around the player, so entities do not pop in on screen
+constexpr float DEFAULT_INTEREST_RADIUS = TILE_SIZE * 48;
+
+/// Size of the cells of the grid used to find the entities in the area of interest of each client
+constexpr float INTEREST_GRID_CELL_SIZE = TILE_SIZE * 8;
+
+/// Size of the cells of the grid used to find the entities each NPC overlaps. About the size of an
+/// entity, so each lookup only checks the entities right around it
+constexpr float SEPARATION_GRID_CELL_SIZE = TILE_SIZE;
+
+/// Options the server is launched with, either from the client "Host" button or the command line of
+/// the dedicated server
+struct ServerConfig
+{
+    u16 port = DEFAULT_PORT;
+    float tick_rate = SERVER_TICK_RATE;
+    int max_clients = DEFAULT_MAX_CLIENTS;
+    int npc_count = DEFAULT_NPC_COUNT;
+    float interest_radius = DEFAULT_INTEREST_RADIUS;
+
+    /// Threads used alongside the server thread to simulate and write snapshots, -1 to use one for
+    /// each of the other cores
+    int worker_threads = -1;
+
+    /// Map file to load, if empty the built-in map is used
+    std::string map_path;
+
+    /// Width and height of the built-in map, which is repeated to fill it
+    int map_tiles = MAP_SIZE;
+};
 
 struct ServerEntity
 {
-    ENetPeer* peer = nullptr; 
+    /// The connection of the client, unset while the player slot is free
+    std::optional<PeerHandle> peer;
     EntityCommon common;
 
+    /// The sequence of the last input simulated, sent back so the client can reconcile
     u32 last_processed = 0;
 
-    std::vector<Input> input_buffer;
+    /// The most recent snapshot the client has received, used as the baseline for delta snapshots
+    u32 acked_snapshot = 0;
+
+    InputJitterBuffer input_buffer;
+
+    /// The chunks of the map the client asked for that are still to be sent
+    MapSender map_sender;
 };
 
 class Server
 {
   public:
-    Server();
+    Server(const ServerConfig& config = {});
     ~Server();
 
     Server operator=(const Server& server) = delete;
@@ -43,10 +105,68 @@ class Server
   private:
     void launch();
 
+    /// Takes the events the network thread has decoded, buffering player inputs for the next tick
+    void handle_events();
+
+    /// Runs one fixed step of the simulation
+    void tick();
+
+    /// Sends every client the changes to the entities around it since the snapshot it last
+    /// acknowledged
+    void send_snapshots();
+
+    /// Sends each client the next of the map chunks it is waiting on, within its budget
+    void send_map_chunks();
+
+    /// The player of the connection, or nullptr if it was never given a slot
+    [[nodiscard]] ServerEntity* find_player(PeerHandle peer);
+
+    /// Frees the player slot of a disconnected peer, returns false if it was never given a slot
+    bool remove_player(PeerHandle peer);
+
+    ServerConfig config_;
+
+    /// Either the built-in map, or loaded by run() from the map file
+    CollisionMap map_;
+    PositionQuantizer position_quantizer_;
+
+    /// The hash of each chunk of the map, read from the map file when it has them
+    std::vector<u64> chunk_hashes_;
+
+    /// Splits the simulation and snapshot writing across cores. Started by run(), so a client that
+    /// never hosts does not start any threads
+    std::optional<JobSystem> jobs_;
+
     std::jthread server_thread_;
     std::atomic_bool running_ = false;
 
-    ENetHost* server_ = nullptr;
+    /// Reads and writes the socket on its own thread, so the simulation never touches ENet
+    ServerNetwork network_;
+
+    /// The first `config_.max_clients` entity ids are players, the free list tracks which are taken
+    SlotAllocator player_slots_;
+    std::vector<ServerEntity> players_;
+
+    /// The player slot of each ENet peer, -1 for peers without one
+    std::vector<int> peer_players_;
+
+    /// The NPCs have the ids after the players
+    NpcArrays npcs_;
+
+    /// The boxes of every entity by id and a grid of the active ones, rebuilt each tick before the
+    /// NPCs move so they can be pushed apart without checking every pair
+    std::vector<SeparationBody> separation_bodies_;
+    SpatialGrid separation_grid_;
+
+    /// The pushes found by each job of NPCs, kept so that finding them each tick does not allocate
+    std::vector<std::vector<SeparationPush>> separation_pushes_;
+
+    u32 snapshot_sequence_ = 0;
+    SnapshotHistory snapshot_history_;
+
+    /// Rebuilt for each snapshot from the active entities, to find what each client is sent
+    SpatialGrid interest_grid_;
 
-    std::vector<ServerEntity> entities_{MAX_ENTITIES};
+    /// The entities each player slot was sent in the recent snapshots
+    std::vector<InterestHistory> client_interests_;
 };
\ No newline at end of file
@@ -0,0 +1,191 @@
+#include <atomic>
+#include <charconv>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <print>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <enet/enet.h>
+
+#include "Server.h"
+
+// Dedicated server entry point - runs the Server without opening a window, or touching any of the
+// SFML graphics or window modules, so many instances can be run on the same machine
+
+namespace
+{
+    std::atomic_bool stop_requested = false;
+
+    void on_signal(int)
+    {
+        stop_requested = true;
+    }
+
+    void print_usage(const char* program)
+    {
+        std::println("Usage: {} [options]", program);
+        std::println("  --port <port>       Port to listen on (default {})", DEFAULT_PORT);
+        std::println("  --tick-rate <tps>   Simulation ticks per second (default {})",
+                     SERVER_TICK_RATE);
+        std::println("  --max-clients <n>   Number of player slots, up to {} (default {})",
+                     MAX_PLAYER_CAPACITY, DEFAULT_MAX_CLIENTS);
+        std::println("  --npcs <count>      Number of NPC entities (default {})",
+                     DEFAULT_NPC_COUNT);
+        std::println("  --interest-radius <pixels>");
+        std::println("                      Distance from a player that entities are sent to it "
+                     "(default {})",
+                     DEFAULT_INTEREST_RADIUS);
+        std::println("  --worker-threads <n>");
+        std::println("                      Threads used alongside the server thread (default one "
+                     "for each other core)");
+        std::println("  --map <file>        Map file to load (default the built-in map)");
+        std::println("  --map-tiles <n>     Width and height of the built-in map, which is "
+                     "repeated to fill it (default {})",
+                     MAP_SIZE);
+        std::println("  --save-map <file>   Write the built-in map to a map file, then exit");
+        std::println("  --help              Show this message");
+    }
+
+    template <typename T>
+    bool parse_value(std::string_view text, T& value)
+    {
+        auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+        return error == std::errc{} && end == text.data() + text.size();
+    }
+
+    /// Returns false if the arguments are invalid, or the help was asked for
+    bool parse_arguments(int argc, char** argv, ServerConfig& config, std::string& save_map_path)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string_view arg = argv[i];
+            if (arg == "--help" || arg == "-h")
+            {
+                return false;
+            }
+            if (arg != "--port" && arg != "--tick-rate" && arg != "--max-clients" &&
+                arg != "--npcs" && arg != "--interest-radius" && arg != "--worker-threads" &&
+                arg != "--map" && arg != "--map-tiles" && arg != "--save-map")
+            {
+                std::println(std::cerr, "Unknown option {}", arg);
+                return false;
+            }
+            if (i + 1 >= argc)
+            {
+                std::println(std::cerr, "Missing value for {}", arg);
+                return false;
+            }
+
+            std::string_view value = argv[++i];
+            bool valid = false;
+            if (arg == "--port")
+            {
+                valid = parse_value(value, config.port);
+            }
+            else if (arg == "--tick-rate")
+            {
+                valid = parse_value(value, config.tick_rate) && config.tick_rate > 0;
+            }
+            else if (arg == "--max-clients")
+            {
+                valid = parse_value(value, config.max_clients) && config.max_clients > 0 &&
+                        config.max_clients <= MAX_PLAYER_CAPACITY;
+            }
+            else if (arg == "--npcs")
+            {
+                valid = parse_value(value, config.npc_count) && config.npc_count >= 0;
+            }
+            else if (arg == "--interest-radius")
+            {
+                valid = parse_value(value, config.interest_radius) && config.interest_radius > 0;
+            }
+            else if (arg == "--worker-threads")
+            {
+                valid = parse_value(value, config.worker_threads) && config.worker_threads >= 0;
+            }
+            else if (arg == "--map")
+            {
+                config.map_path = value;
+                valid = !value.empty();
+            }
+            else if (arg == "--map-tiles")
+            {
+                valid = parse_value(value, config.map_tiles) && config.map_tiles > 0 &&
+                        config.map_tiles <= MAX_MAP_TILES;
+            }
+            else if (arg == "--save-map")
+            {
+                save_map_path = value;
+                valid = !value.empty();
+            }
+
+            if (!valid)
+            {
+                std::println(std::cerr, "Invalid value '{}' for {}", value, arg);
+                return false;
+            }
+        }
+        if (config.max_clients + config.npc_count > std::numeric_limits<i16>::max())
+        {
+            std::println(std::cerr, "Too many entities, player slots + NPCs must be at most {}",
+                         std::numeric_limits<i16>::max());
+            return false;
+        }
+        return true;
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    ServerConfig config;
+    std::string save_map_path;
+    if (!parse_arguments(argc, argv, config, save_map_path))
+    {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!save_map_path.empty())
+    {
+        if (!make_built_in_map(config.map_tiles, config.map_tiles).save(save_map_path))
+        {
+            std::println(std::cerr, "Failed to write the map file '{}'.", save_map_path);
+            return EXIT_FAILURE;
+        }
+        std::println("Wrote a {}x{} tile map to '{}'.", config.map_tiles, config.map_tiles,
+                     save_map_path);
+        return EXIT_SUCCESS;
+    }
+
+    if (enet_initialize() != 0)
+    {
+        std::println(std::cerr, "Failed to init ENet.");
+        return EXIT_FAILURE;
+    }
+
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    {
+        Server server{config};
+        if (!server.run())
+        {
+            enet_deinitialize();
+            return EXIT_FAILURE;
+        }
+
+        while (!stop_requested)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        std::println("[Server] Shutting down.");
+        server.stop();
+    }
+
+    enet_deinitialize();
+    return EXIT_SUCCESS;
+}
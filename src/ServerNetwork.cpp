@@ -0,0 +1,347 @@
+#include "ServerNetwork.h"
+
+#include <array>
+
+#include "MapStream.h"
+
+namespace
+{
+    /// Packets are only owned by ENet once queued on a peer, those that never were are freed here
+    void drop_packet(ENetPacket* packet)
+    {
+        if (packet && packet->referenceCount == 0)
+        {
+            enet_packet_destroy(packet);
+        }
+    }
+} // namespace
+
+ServerNetwork::~ServerNetwork()
+{
+    stop();
+}
+
+bool ServerNetwork::start(u16 port, size_t peer_count, int map_chunk_count)
+{
+    ENetAddress address = {.host = ENET_HOST_ANY, .port = port, .sin6_scope_id = 0};
+    host_ = enet_host_create(&address, peer_count, CHANNEL_COUNT, 0, 0);
+    if (!host_)
+    {
+        return false;
+    }
+
+    map_chunk_count_ = map_chunk_count;
+    peers_.assign(peer_count, {});
+    reliable_in_transit_ = std::vector<std::atomic<u32>>(peer_count);
+
+    running_ = true;
+    thread_ = std::jthread([this] { loop(); });
+    return true;
+}
+
+void ServerNetwork::stop()
+{
+    if (running_)
+    {
+        running_ = false;
+        thread_.join();
+    }
+
+    // Packets queued after the thread stopped are never going to be sent
+    while (auto command = commands_.try_pop())
+    {
+        drop_packet(command->packet);
+    }
+
+    if (host_)
+    {
+        enet_host_destroy(host_);
+        host_ = nullptr;
+    }
+}
+
+std::optional<NetworkEvent> ServerNetwork::poll()
+{
+    return events_.try_pop();
+}
+
+void ServerNetwork::send(PeerHandle peer, u8 channel, ENetPacket* packet)
+{
+    if (!packet)
+    {
+        return;
+    }
+    push_command({.type = CommandType::Send, .channel = channel, .peer = peer, .packet = packet});
+}
+
+void ServerNetwork::broadcast(u8 channel, ENetPacket* packet)
+{
+    if (!packet)
+    {
+        return;
+    }
+    push_command(
+        {.type = CommandType::Broadcast, .channel = channel, .peer = {}, .packet = packet});
+}
+
+void ServerNetwork::disconnect(PeerHandle peer, DisconnectReason reason)
+{
+    push_command({.type = CommandType::Disconnect, .peer = peer, .reason = reason});
+}
+
+u32 ServerNetwork::reliable_data_in_transit(PeerHandle peer) const
+{
+    if (peer.index >= reliable_in_transit_.size())
+    {
+        return 0;
+    }
+    return reliable_in_transit_[peer.index].load(std::memory_order_relaxed);
+}
+
+void ServerNetwork::loop()
+{
+    ENetEvent event;
+    while (running_)
+    {
+        run_commands();
+
+        // Sends what was queued, then waits for a packet to arrive. Once one has, every other event
+        // that is ready is taken as well
+        if (enet_host_service(host_, &event, NETWORK_POLL_TIMEOUT_MS) > 0)
+        {
+            do
+            {
+                handle_event(event);
+            } while (enet_host_check_events(host_, &event) > 0);
+        }
+
+        while (!held_events_.empty())
+        {
+            // The count of an earlier connection of the peer was reset when it disconnected
+            auto index = held_events_.front().peer.index;
+            auto connection = held_events_.front().peer.connection;
+            if (!events_.try_push(std::move(held_events_.front())))
+            {
+                break;
+            }
+            held_events_.pop_front();
+            if (peers_[index].connection == connection)
+            {
+                peers_[index].held_events--;
+            }
+        }
+
+        for (size_t i = 0; i < peers_.size(); i++)
+        {
+            reliable_in_transit_[i].store(host_->peers[i].reliableDataInTransit,
+                                          std::memory_order_relaxed);
+        }
+    }
+}
+
+void ServerNetwork::push_command(Command&& command)
+{
+    // The network thread takes commands every time round its loop, so this only waits when a burst
+    // of packets has filled the queue
+    while (!commands_.try_push(std::move(command)))
+    {
+        if (!running_)
+        {
+            drop_packet(command.packet);
+            return;
+        }
+        std::this_thread::yield();
+    }
+}
+
+void ServerNetwork::run_commands()
+{
+    while (auto command = commands_.try_pop())
+    {
+        switch (command->type)
+        {
+            case CommandType::Send:
+            {
+                auto peer = find_peer(command->peer);
+                if (!peer || enet_peer_send(peer, command->channel, command->packet) != 0)
+                {
+                    drop_packet(command->packet);
+                }
+            }
+            break;
+
+            case CommandType::Broadcast:
+                enet_host_broadcast(host_, command->channel, command->packet);
+                break;
+
+            case CommandType::Disconnect:
+                if (auto peer = find_peer(command->peer))
+                {
+                    enet_peer_disconnect(peer, static_cast<enet_uint32>(command->reason));
+                }
+                break;
+        }
+    }
+}
+
+void ServerNetwork::handle_event(ENetEvent& event)
+{
+    auto index = event.peer->incomingPeerID;
+    auto& peer = peers_[index];
+    switch (event.type)
+    {
+        case ENET_EVENT_TYPE_CONNECT:
+        {
+            peer = {.connection = ++connection_count_};
+            push_event({.peer = {index, peer.connection}, .data = ConnectEvent{}});
+        }
+        break;
+
+        case ENET_EVENT_TYPE_RECEIVE:
+        {
+            if (peer.connection != 0)
+            {
+                decode_message({index, peer.connection}, event.packet);
+            }
+            enet_packet_destroy(event.packet);
+        }
+        break;
+
+        case ENET_EVENT_TYPE_DISCONNECT:
+        case ENET_EVENT_TYPE_DISCONNECT_TIMEOUT:
+        {
+            if (peer.connection != 0)
+            {
+                auto timed_out = event.type == ENET_EVENT_TYPE_DISCONNECT_TIMEOUT;
+                push_event({.peer = {index, peer.connection},
+                            .data = DisconnectEvent{.timed_out = timed_out}});
+            }
+            peer = {};
+        }
+        break;
+
+        default:
+            break;
+    }
+}
+
+void ServerNetwork::decode_message(PeerHandle handle, ENetPacket* packet)
+{
+    ToServerMessageReader message{packet};
+    switch (message.message_type)
+    {
+        case ToServerMessageType::Message:
+        {
+            if (auto chat = message.read<ToServerChatMessage>())
+            {
+                push_event({.peer = handle, .data = std::move(*chat)});
+            }
+        }
+        break;
+
+        case ToServerMessageType::Input:
+        {
+            std::array<Input, MAX_INPUTS_PER_MESSAGE> inputs;
+            u32 acked_snapshot = 0;
+            auto count = read_input_message(message, inputs, acked_snapshot);
+            if (!count)
+            {
+                break;
+            }
+
+            auto& peer = peers_[handle.index];
+            if (acked_snapshot > peer.acked_snapshot)
+            {
+                peer.acked_snapshot = acked_snapshot;
+                push_event({.peer = handle, .data = SnapshotAckEvent{acked_snapshot}});
+            }
+
+            // Each input is sent until it is simulated, so most of them have been passed on already
+            for (int i = 0; i < *count; i++)
+            {
+                if (is_new_input(peer, inputs[i].sequence))
+                {
+                    push_event({.peer = handle, .data = InputEvent{inputs[i]}});
+                }
+            }
+        }
+        break;
+
+        case ToServerMessageType::MapChunkRequest:
+        {
+            auto chunks = read_map_chunk_request(message, map_chunk_count_);
+            push_event({.peer = handle, .data = MapRequestEvent{std::move(chunks)}});
+        }
+        break;
+
+        default:
+            break;
+    }
+}
+
+void ServerNetwork::push_event(NetworkEvent&& event)
+{
+    // The rest of a message from a peer that was just disconnected for sending too much
+    auto index = event.peer.index;
+    auto& peer = peers_[index];
+    if (peer.connection != event.peer.connection)
+    {
+        return;
+    }
+
+    // Once any event is held back the rest must be too, to keep them in order
+    if (held_events_.empty() && events_.try_push(std::move(event)))
+    {
+        return;
+    }
+
+    // The disconnect is always passed on, so the simulation frees the player
+    if (!std::holds_alternative<DisconnectEvent>(event.data) &&
+        ++peer.held_events > MAX_HELD_EVENTS_PER_PEER)
+    {
+        // Disconnecting now gives no disconnect event from ENet, so it is passed on from here
+        enet_peer_disconnect_now(&host_->peers[index],
+                                 static_cast<enet_uint32>(DisconnectReason::None));
+        held_events_.push_back({.peer = event.peer, .data = DisconnectEvent{}});
+        peer = {};
+        return;
+    }
+    held_events_.push_back(std::move(event));
+}
+
+bool ServerNetwork::is_new_input(Peer& peer, u32 sequence)
+{
+    // Unsigned, so the sequences may wrap
+    auto ahead = sequence - peer.latest_input;
+    if (ahead != 0 && ahead < 0x80000000u)
+    {
+        peer.passed_inputs = ahead < 64 ? peer.passed_inputs << ahead : 0;
+        peer.passed_inputs |= 1;
+        peer.latest_input = sequence;
+        return true;
+    }
+
+    // Inputs too far behind to be tracked are left for the input buffer to drop
+    auto behind = peer.latest_input - sequence;
+    if (behind >= 64)
+    {
+        return true;
+    }
+    auto bit = u64{1} << behind;
+    if (peer.passed_inputs & bit)
+    {
+        return false;
+    }
+    peer.passed_inputs |= bit;
+    return true;
+}
+
+ENetPeer* ServerNetwork::find_peer(PeerHandle handle) const
+{
+    if (handle.connection == 0 || handle.index >= peers_.size() ||
+        peers_[handle.index].connection != handle.connection)
+    {
+        return nullptr;
+    }
+    return &host_->peers[handle.index];
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <optional>
+#include <thread>
+#include <variant>
+#include <vector>
+
+#include <enet/enet.h>
+
+#include "Common.h"
+#include "NetworkMessage.h"
+#include "Util/LockFreeQueue.h"
+
+/// Longest the network thread waits on the socket before checking for packets to send. Packets
+/// queued by the simulation wait at most this long to go out
+constexpr enet_uint32 NETWORK_POLL_TIMEOUT_MS = 1;
+
+/// Events the network thread can have decoded that the simulation has not yet taken. Past this they
+/// are held back by the network thread until there is room
+constexpr size_t NETWORK_EVENT_QUEUE_SIZE = 4096;
+
+/// Packets the simulation and the snapshot jobs can have queued that the network thread has not yet
+/// sent. Past this the senders wait for room
+constexpr size_t NETWORK_COMMAND_QUEUE_SIZE = 4096;
+
+/// Events of one connection that can be held back by the network thread. A client that sends more
+/// than this while the simulation is behind is disconnected, rather than held events growing
+/// without bound
+constexpr u32 MAX_HELD_EVENTS_PER_PEER = 1024;
+
+/// Identifies a connection. ENet reuses its peers, so the connection is counted as well to tell a
+/// peer's new connection from the one it had before
+struct PeerHandle
+{
+    u16 index = 0;
+    u32 connection = 0;
+
+    bool operator==(const PeerHandle&) const = default;
+};
+
+struct ConnectEvent
+{
+};
+
+struct DisconnectEvent
+{
+    bool timed_out = false;
+};
+
+/// One input the network thread has not passed on from this connection before. Inputs are resent
+/// until they are simulated, so the repeats are dropped. Whether the input is still in time to be
+/// simulated is left to the player's input buffer
+struct InputEvent
+{
+    Input input;
+};
+
+/// The client has a newer snapshot to use as the baseline of its delta snapshots
+struct SnapshotAckEvent
+{
+    u32 sequence = 0;
+};
+
+struct MapRequestEvent
+{
+    std::vector<u32> chunks;
+};
+
+struct NetworkEvent
+{
+    PeerHandle peer;
+    std::variant<ConnectEvent, DisconnectEvent, ToServerChatMessage, InputEvent, SnapshotAckEvent,
+                 MapRequestEvent>
+        data;
+};
+
+/// Runs the ENet host of the server on a thread of its own, so reading the socket is never held up
+/// by a long tick, and inputs are decoded as soon as they arrive rather than at the next tick.
+///
+/// Messages from clients are decoded into events, passed to the simulation through a single
+/// producer queue. Packets to send go the other way through a multiple producer queue, so the
+/// snapshot jobs can queue their packets as they write them. ENet is only touched by this thread.
+class ServerNetwork
+{
+  public:
+    ServerNetwork() = default;
+    ~ServerNetwork();
+
+    ServerNetwork(const ServerNetwork&) = delete;
+    ServerNetwork& operator=(const ServerNetwork&) = delete;
+
+    /// Creates the host and starts the network thread. Requests for chunks past `map_chunk_count`
+    /// are dropped while decoding
+    [[nodiscard]] bool start(u16 port, size_t peer_count, int map_chunk_count);
+    void stop();
+
+    /// Simulation thread only. Returns nullopt once there are no more events
+    [[nodiscard]] std::optional<NetworkEvent> poll();
+
+    /// Any thread. Takes ownership of the packet, which is dropped if the connection has closed.
+    /// A null packet (one that failed to be written) is ignored
+    void send(PeerHandle peer, u8 channel, ENetPacket* packet);
+    void broadcast(u8 channel, ENetPacket* packet);
+    void disconnect(PeerHandle peer, DisconnectReason reason);
+
+    /// Bytes of reliable packets sent to the peer that it has not acknowledged, as of the last time
+    /// the network thread looked
+    [[nodiscard]] u32 reliable_data_in_transit(PeerHandle peer) const;
+
+  private:
+    enum class CommandType : u8
+    {
+        Send,
+        Broadcast,
+        Disconnect,
+    };
+
+    struct Command
+    {
+        CommandType type = CommandType::Send;
+        u8 channel = 0;
+        PeerHandle peer;
+        ENetPacket* packet = nullptr;
+        DisconnectReason reason = DisconnectReason::None;
+    };
+
+    /// State the network thread keeps for each ENet peer
+    struct Peer
+    {
+        /// 0 while the peer is not connected
+        u32 connection = 0;
+
+        /// Bit i is set if input `latest_input - i` has already been passed on. Inputs that arrive
+        /// out of order are passed on as long as they are not repeats
+        u32 latest_input = 0;
+        u64 passed_inputs = 0;
+
+        /// Events of this connection in `held_events_`
+        u32 held_events = 0;
+
+        /// Latest snapshot the client has acknowledged. Input packets are unsequenced, so an older
+        /// acknowledgement can arrive after a newer one
+        u32 acked_snapshot = 0;
+    };
+
+    void loop();
+    void push_command(Command&& command);
+    void run_commands();
+    void handle_event(ENetEvent& event);
+    void decode_message(PeerHandle handle, ENetPacket* packet);
+    void push_event(NetworkEvent&& event);
+
+    /// Returns true the first time the peer's input is seen
+    [[nodiscard]] static bool is_new_input(Peer& peer, u32 sequence);
+
+    /// Returns the peer if it still has the connection
+    [[nodiscard]] ENetPeer* find_peer(PeerHandle handle) const;
+
+    ENetHost* host_ = nullptr;
+    int map_chunk_count_ = 0;
+
+    std::jthread thread_;
+    std::atomic_bool running_ = false;
+
+    SpscQueue<NetworkEvent> events_{NETWORK_EVENT_QUEUE_SIZE};
+    MpscQueue<Command> commands_{NETWORK_COMMAND_QUEUE_SIZE};
+
+    /// Events that did not fit in the queue, kept in order until there is room
+    std::deque<NetworkEvent> held_events_;
+
+    std::vector<Peer> peers_;
+    u32 connection_count_ = 0;
+
+    /// Indexed by peer, written by the network thread for the map streaming to read
+    std::vector<std::atomic<u32>> reliable_in_transit_;
+};
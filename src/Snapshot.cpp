@@ -0,0 +1,414 @@
+#include "Snapshot.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <span>
+
+namespace
+{
+    /// Which fields of an entity are included in a snapshot. The active and visible flags are
+    /// single bits, so the field being included is enough to say it has flipped
+    enum SnapshotField : u8
+    {
+        Position = 1,
+        LastProcessed = 1 << 1,
+        Active = 1 << 2,
+
+        /// The entity has entered or left the area of interest of the client
+        Visible = 1 << 3,
+    };
+    constexpr int SNAPSHOT_FIELD_BITS = 4;
+
+    constexpr size_t SNAPSHOT_HEADER_BITS = MESSAGE_TYPE_BITS + FIXED_BITS<SnapshotMessage>;
+
+    constexpr float POSITION_STEPS_PER_PIXEL = 32;
+
+    /// Input sequences are sent as the change from the baseline, zigzag encoded so a client that
+    /// reconnected into the same slot (and so went backwards) still takes few bits
+    u32 sequence_delta(u32 sequence, u32 baseline)
+    {
+        auto delta = static_cast<i32>(sequence - baseline);
+        return (static_cast<u32>(delta) << 1) ^ static_cast<u32>(delta >> 31);
+    }
+
+    u32 apply_sequence_delta(u32 baseline, u32 encoded)
+    {
+        auto delta = static_cast<i32>(encoded >> 1) ^ -static_cast<i32>(encoded & 1);
+        return baseline + static_cast<u32>(delta);
+    }
+
+    /// Positions are compared once quantized, as smaller changes cannot be sent anyway
+    u8 changed_fields(const EntitySnapshot& entity, const EntitySnapshot& baseline,
+                      const PositionQuantizer& quantizer)
+    {
+        u8 fields = 0;
+        if (quantizer.quantize(entity.position.x) != quantizer.quantize(baseline.position.x) ||
+            quantizer.quantize(entity.position.y) != quantizer.quantize(baseline.position.y))
+        {
+            fields |= SnapshotField::Position;
+        }
+        if (entity.last_processed != baseline.last_processed)
+        {
+            fields |= SnapshotField::LastProcessed;
+        }
+        if (entity.active != baseline.active)
+        {
+            fields |= SnapshotField::Active;
+        }
+        return fields;
+    }
+
+    struct ChangedEntity
+    {
+        u16 id = 0;
+        u8 fields = 0;
+        u32 last_processed_delta = 0;
+    };
+
+    /// The size in bits of a record, given the id of the record before it in the same part
+    size_t record_bits(const ChangedEntity& record, int previous_id, int position_bits)
+    {
+        auto id_gap = static_cast<u32>(record.id - previous_id - 1);
+        size_t bits = BitWriter::varint_bits(id_gap) + SNAPSHOT_FIELD_BITS;
+        if (record.fields & SnapshotField::Position)
+        {
+            bits += position_bits * 2;
+        }
+        if (record.fields & SnapshotField::LastProcessed)
+        {
+            bits += BitWriter::varint_bits(record.last_processed_delta);
+        }
+        return bits;
+    }
+} // namespace
+
+PositionQuantizer::PositionQuantizer(int map_tiles)
+    : min_(-map_tiles * TILE_SIZE)
+    , max_step_(static_cast<u32>(map_tiles * TILE_SIZE * 3 * POSITION_STEPS_PER_PIXEL) - 1)
+    , bits_(std::bit_width(max_step_))
+{
+}
+
+u32 PositionQuantizer::quantize(float value) const
+{
+    // In double, as a float offset by the size of a large map loses the precision of the steps
+    auto step = std::round((static_cast<double>(value) - min_) * POSITION_STEPS_PER_PIXEL);
+    return static_cast<u32>(std::clamp(step, 0.0, static_cast<double>(max_step_)));
+}
+
+float PositionQuantizer::dequantize(u32 step) const
+{
+    return static_cast<float>(step) / POSITION_STEPS_PER_PIXEL + min_;
+}
+
+int PositionQuantizer::bits() const
+{
+    return bits_;
+}
+
+void SnapshotHistory::push(WorldSnapshot snapshot)
+{
+    auto& slot = snapshots_[snapshot.sequence % SNAPSHOT_HISTORY_SIZE];
+    slot = std::move(snapshot);
+}
+
+const WorldSnapshot* SnapshotHistory::find(u32 sequence) const
+{
+    if (sequence == 0)
+    {
+        return nullptr;
+    }
+
+    auto& snapshot = snapshots_[sequence % SNAPSHOT_HISTORY_SIZE];
+    return snapshot.sequence == sequence ? &snapshot : nullptr;
+}
+
+void InterestHistory::push(u32 sequence, std::vector<u16> ids)
+{
+    interests_[sequence % SNAPSHOT_HISTORY_SIZE] = {sequence, std::move(ids)};
+}
+
+void InterestHistory::clear()
+{
+    for (auto& [sequence, ids] : interests_)
+    {
+        sequence = 0;
+        ids.clear();
+    }
+}
+
+const std::vector<u16>* InterestHistory::find(u32 sequence) const
+{
+    if (sequence == 0)
+    {
+        return nullptr;
+    }
+
+    auto& [stored_sequence, ids] = interests_[sequence % SNAPSHOT_HISTORY_SIZE];
+    return stored_sequence == sequence ? &ids : nullptr;
+}
+
+std::vector<PacketWriter> write_snapshot(const WorldSnapshot& snapshot,
+                                         std::span<const u16> interest,
+                                         const WorldSnapshot* baseline,
+                                         std::span<const u16> baseline_interest,
+                                         const PositionQuantizer& quantizer)
+{
+    // A baseline is only usable if it describes the same set of entities
+    if (baseline && baseline->entities.size() != snapshot.entities.size())
+    {
+        baseline = nullptr;
+    }
+    if (!baseline)
+    {
+        baseline_interest = {};
+    }
+
+    // Entities entering the area of interest are written against the default state, so only the
+    // fields that are actually in use are sent (eg NPCs never send an input sequence)
+    const EntitySnapshot empty_entity;
+
+    // Both sets of ids are sorted, so they are walked together to find the entities that are in
+    // both, and those that have entered or left. This keeps the records in id order
+    std::vector<ChangedEntity> changed;
+    changed.reserve(interest.size());
+    size_t base_index = 0;
+    auto add_leaving_before = [&](size_t end_id)
+    {
+        for (; base_index < baseline_interest.size() && baseline_interest[base_index] < end_id;
+             base_index++)
+        {
+            changed.push_back(
+                {.id = baseline_interest[base_index], .fields = SnapshotField::Visible});
+        }
+    };
+    for (auto id : interest)
+    {
+        add_leaving_before(id);
+        bool was_visible =
+            base_index < baseline_interest.size() && baseline_interest[base_index] == id;
+
+        auto& entity = snapshot.entities[id];
+        auto& base = was_visible ? baseline->entities[id] : empty_entity;
+        auto fields = changed_fields(entity, base, quantizer);
+        if (was_visible)
+        {
+            base_index++;
+        }
+        else
+        {
+            fields |= SnapshotField::Visible;
+        }
+
+        if (fields)
+        {
+            changed.push_back({.id = id,
+                               .fields = fields,
+                               .last_processed_delta =
+                                   sequence_delta(entity.last_processed, base.last_processed)});
+        }
+    }
+    add_leaving_before(snapshot.entities.size());
+
+    // Split the records into parts that each fit into a packet. There is always at least one part,
+    // even when nothing has changed, so the client can still complete and acknowledge the snapshot
+    constexpr size_t part_capacity = SNAPSHOT_PACKET_SIZE * 8 - SNAPSHOT_HEADER_BITS;
+    std::vector<size_t> part_starts{0};
+    size_t part_bits = 0;
+    int previous_id = -1;
+    for (size_t i = 0; i < changed.size(); i++)
+    {
+        auto bits = record_bits(changed[i], previous_id, quantizer.bits());
+        if (part_bits + bits > part_capacity)
+        {
+            // Ids are written as the gap from the previous record, which restarts in each part
+            part_starts.push_back(i);
+            bits = record_bits(changed[i], -1, quantizer.bits());
+            part_bits = 0;
+        }
+        part_bits += bits;
+        previous_id = changed[i].id;
+    }
+    part_starts.push_back(changed.size());
+
+    // The records follow straight on from the header, in the same bit stream
+    auto part_count = static_cast<u16>(part_starts.size() - 1);
+    std::vector<PacketWriter> packets;
+    packets.reserve(part_count);
+    for (u16 part = 0; part < part_count; part++)
+    {
+        auto begin = part_starts[part];
+        auto end = part_starts[part + 1];
+
+        auto& writer = packets.emplace_back(SNAPSHOT_PACKET_SIZE).stream();
+        write_message(writer, SnapshotMessage{
+                                  .sequence = snapshot.sequence,
+                                  .baseline = baseline ? baseline->sequence : 0,
+                                  .entity_count = static_cast<u16>(snapshot.entities.size()),
+                                  .part = part,
+                                  .part_count = part_count,
+                                  .record_count = static_cast<u16>(end - begin),
+                              });
+
+        previous_id = -1;
+        for (auto& record : std::span{changed}.subspan(begin, end - begin))
+        {
+            auto& entity = snapshot.entities[record.id];
+            writer.write_varint(static_cast<u32>(record.id - previous_id - 1));
+            writer.write(record.fields, SNAPSHOT_FIELD_BITS);
+            if (record.fields & SnapshotField::Position)
+            {
+                writer.write(quantizer.quantize(entity.position.x), quantizer.bits());
+                writer.write(quantizer.quantize(entity.position.y), quantizer.bits());
+            }
+            if (record.fields & SnapshotField::LastProcessed)
+            {
+                writer.write_varint(record.last_processed_delta);
+            }
+            previous_id = record.id;
+        }
+    }
+    return packets;
+}
+
+SnapshotPartResult SnapshotReceiver::read_part(ToClientMessageReader& message,
+                                               const PositionQuantizer& quantizer)
+{
+    updated_entities_.clear();
+
+    auto header = message.read<SnapshotMessage>();
+    if (!header)
+    {
+        return SnapshotPartResult::Dropped;
+    }
+    const auto& [sequence, baseline_sequence, entity_count, part, part_count, record_count] =
+        *header;
+
+    // Snapshots are unsequenced, so parts of older snapshots than the one being rebuilt are dropped
+    if (sequence < snapshot_.sequence || sequence <= latest_complete_ ||
+        part >= part_count)
+    {
+        return SnapshotPartResult::Dropped;
+    }
+
+    // The whole part is read before any of it is applied. The flags are sent as flips, so applying
+    // some of a bad part would leave the snapshot wrong even once every part has arrived
+    auto& reader = message.stream;
+    part_records_.clear();
+    int previous_id = -1;
+    for (u16 i = 0; i < record_count; i++)
+    {
+        // The gap comes from the packet, so it is added in 64 bits where it cannot overflow
+        auto next_id = static_cast<i64>(previous_id) + 1 + reader.read_varint();
+        auto& record = part_records_.emplace_back();
+        record.fields = static_cast<u8>(reader.read(SNAPSHOT_FIELD_BITS));
+        if (!reader.is_valid() || next_id >= entity_count)
+        {
+            return SnapshotPartResult::Dropped;
+        }
+        record.id = static_cast<u16>(next_id);
+        previous_id = record.id;
+
+        if (record.fields & SnapshotField::Position)
+        {
+            record.position.x = quantizer.dequantize(reader.read(quantizer.bits()));
+            record.position.y = quantizer.dequantize(reader.read(quantizer.bits()));
+        }
+        if (record.fields & SnapshotField::LastProcessed)
+        {
+            record.last_processed_delta = reader.read_varint();
+        }
+    }
+    if (!reader.is_valid())
+    {
+        return SnapshotPartResult::Dropped;
+    }
+
+    // The first part to arrive of a newer snapshot starts it from its baseline, abandoning any
+    // incomplete snapshot
+    if (sequence > snapshot_.sequence)
+    {
+        if (baseline_sequence == 0)
+        {
+            snapshot_.entities.assign(entity_count, {});
+        }
+        else
+        {
+            auto baseline = history_.find(baseline_sequence);
+            if (!baseline || baseline->entities.size() != entity_count)
+            {
+                return SnapshotPartResult::Dropped;
+            }
+            snapshot_.entities = baseline->entities;
+        }
+        snapshot_.sequence = sequence;
+        parts_received_.assign(part_count, false);
+        parts_remaining_ = part_count;
+        was_updated_.assign(entity_count, false);
+    }
+
+    if (parts_received_.size() != part_count || parts_received_[part])
+    {
+        return SnapshotPartResult::Dropped;
+    }
+
+    for (const auto& [id, fields, position, last_processed_delta] : part_records_)
+    {
+        // Entities that leave the area of interest are reset, so they are in the default state for
+        // when they enter it again
+        auto& entity = snapshot_.entities[id];
+        if (fields & SnapshotField::Visible)
+        {
+            entity.visible = !entity.visible;
+            if (!entity.visible)
+            {
+                entity = {};
+            }
+        }
+        if (fields & SnapshotField::Position)
+        {
+            entity.position = position;
+        }
+        if (fields & SnapshotField::LastProcessed)
+        {
+            entity.last_processed = apply_sequence_delta(entity.last_processed, last_processed_delta);
+        }
+        if (fields & SnapshotField::Active)
+        {
+            entity.active = !entity.active;
+        }
+        updated_entities_.push_back(id);
+        was_updated_[id] = true;
+    }
+
+    parts_received_[part] = true;
+    if (--parts_remaining_ > 0)
+    {
+        return SnapshotPartResult::Applied;
+    }
+
+    latest_complete_ = sequence;
+    history_.push(snapshot_);
+    return SnapshotPartResult::Completed;
+}
+
+const WorldSnapshot& SnapshotReceiver::snapshot() const
+{
+    return snapshot_;
+}
+
+const std::vector<u16>& SnapshotReceiver::updated_entities() const
+{
+    return updated_entities_;
+}
+
+bool SnapshotReceiver::was_updated(u16 id) const
+{
+    return id < was_updated_.size() && was_updated_[id];
+}
+
+u32 SnapshotReceiver::latest_complete() const
+{
+    return latest_complete_;
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <array>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include <SFML/System/Vector2.hpp>
+
+#include "Common.h"
+#include "NetworkMessage.h"
+
+/// The state of a single entity that is sent to clients
+struct EntitySnapshot
+{
+    sf::Vector2f position;
+    u32 last_processed = 0;
+    bool active = false;
+
+    /// Only used by the client, if the entity is in its area of interest. Entities outside of it are
+    /// kept in the default state
+    bool visible = false;
+};
+
+/// The state of every entity at a server tick. Sequence 0 is never used, and means "no snapshot"
+struct WorldSnapshot
+{
+    u32 sequence = 0;
+    std::vector<EntitySnapshot> entities;
+};
+
+/// How many snapshots are kept by both the server and client to use as delta baselines
+constexpr u32 SNAPSHOT_HISTORY_SIZE = 32;
+
+/// Largest size of a single snapshot packet. This is kept under the ENet MTU (once the ENet and UDP
+/// headers are added) so snapshots are never fragmented, as losing one fragment loses the lot
+constexpr size_t SNAPSHOT_PACKET_SIZE = 1200;
+static_assert(SNAPSHOT_PACKET_SIZE + 100 < ENET_HOST_DEFAULT_MTU);
+
+/// Converts positions to and from the fixed point they are sent as in snapshots, in steps of 1/32 of
+/// a pixel. The range covers the map, widened by the size of the map either side as entities are
+/// able to leave it, so the number of bits a position takes depends on the size of the map
+class PositionQuantizer
+{
+  public:
+    /// `map_tiles` is the larger of the width and height of the map
+    explicit PositionQuantizer(int map_tiles = MAP_SIZE);
+
+    [[nodiscard]] u32 quantize(float value) const;
+    [[nodiscard]] float dequantize(u32 step) const;
+
+    /// Bits each axis of a position takes
+    [[nodiscard]] int bits() const;
+
+  private:
+    float min_ = 0;
+    u32 max_step_ = 0;
+    int bits_ = 0;
+};
+
+/// Ring buffer of the most recent snapshots, indexed by sequence
+class SnapshotHistory
+{
+  public:
+    void push(WorldSnapshot snapshot);
+
+    /// Returns nullptr if the snapshot is too old, or was never stored
+    [[nodiscard]] const WorldSnapshot* find(u32 sequence) const;
+
+  private:
+    std::array<WorldSnapshot, SNAPSHOT_HISTORY_SIZE> snapshots_;
+};
+
+/// The ids of the entities in the area of interest of a client for each of the most recent
+/// snapshots, so the client can be told which entities have entered or left it since its baseline
+class InterestHistory
+{
+  public:
+    /// The ids must be sorted
+    void push(u32 sequence, std::vector<u16> ids);
+    void clear();
+
+    /// Returns nullptr if the snapshot is too old, or was never stored
+    [[nodiscard]] const std::vector<u16>* find(u32 sequence) const;
+
+  private:
+    std::array<std::pair<u32, std::vector<u16>>, SNAPSHOT_HISTORY_SIZE> interests_;
+};
+
+/// Writes what a client can see of the snapshot as a delta against its baseline. Only the entities
+/// in `interest` are written, which are the sorted ids of the entities in the client's area of
+/// interest.
+///
+/// Entities that were also in `baseline_interest` only have the fields that changed since the
+/// baseline written. Entities that have entered the area are written in full, and entities that
+/// have left it are written as just an id, so the client resets them. If there is no baseline then
+/// every entity in the area is written in full.
+///
+/// The entities are split across as many packets as needed to keep each under
+/// SNAPSHOT_PACKET_SIZE. Each packet can be read on its own, so a lost packet only loses the
+/// entities that were in it.
+[[nodiscard]] std::vector<PacketWriter>
+write_snapshot(const WorldSnapshot& snapshot, std::span<const u16> interest,
+               const WorldSnapshot* baseline, std::span<const u16> baseline_interest,
+               const PositionQuantizer& quantizer);
+
+enum class SnapshotPartResult
+{
+    /// The part is stale, a duplicate, malformed, or its baseline is no longer known
+    Dropped,
+
+    /// The entities in the part have been updated
+    Applied,
+
+    /// As above, and it was the final missing part of the snapshot
+    Completed,
+};
+
+/// Rebuilds snapshots on the client from the parts written by write_snapshot.
+///
+/// Each part updates the entities in it as soon as it arrives. A snapshot only becomes a baseline
+/// (and so is acknowledged to the server) once all of its parts have arrived.
+class SnapshotReceiver
+{
+  public:
+    /// The quantizer must match the one the server wrote the snapshot with
+    [[nodiscard]] SnapshotPartResult read_part(ToClientMessageReader& message,
+                                               const PositionQuantizer& quantizer);
+
+    /// The snapshot being rebuilt - only fully up to date once it is complete
+    [[nodiscard]] const WorldSnapshot& snapshot() const;
+
+    /// The entities that were updated by the last part that was read
+    [[nodiscard]] const std::vector<u16>& updated_entities() const;
+
+    /// If any part of the current snapshot has updated the entity
+    [[nodiscard]] bool was_updated(u16 id) const;
+
+    /// The latest snapshot that is fully rebuilt, this is what the client acknowledges
+    [[nodiscard]] u32 latest_complete() const;
+
+  private:
+    /// A record of a part as it was read, before it is applied to the snapshot
+    struct PartRecord
+    {
+        u16 id = 0;
+        u8 fields = 0;
+        sf::Vector2f position;
+        u32 last_processed_delta = 0;
+    };
+
+    SnapshotHistory history_;
+    WorldSnapshot snapshot_;
+
+    /// The records of the part being read. Kept so that reading each part does not allocate
+    std::vector<PartRecord> part_records_;
+
+    std::vector<bool> parts_received_;
+    int parts_remaining_ = 0;
+
+    std::vector<u16> updated_entities_;
+    std::vector<bool> was_updated_;
+
+    u32 latest_complete_ = 0;
+};
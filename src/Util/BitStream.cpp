@@ -0,0 +1,151 @@
+#include "BitStream.h"
+
+#include <algorithm>
+#include <bit>
+#include <limits>
+
+BitWriter::BitWriter(std::uint8_t* data, std::size_t capacity)
+    : data_(data)
+    , capacity_(capacity)
+{
+}
+
+void BitWriter::write(std::uint32_t value, int bits)
+{
+    if (bits < 32)
+    {
+        value &= (1u << bits) - 1;
+    }
+    scratch_ |= static_cast<std::uint64_t>(value) << scratch_bits_;
+    scratch_bits_ += bits;
+    bit_count_ += bits;
+
+    while (scratch_bits_ >= 8)
+    {
+        write_byte(static_cast<std::uint8_t>(scratch_));
+        scratch_ >>= 8;
+        scratch_bits_ -= 8;
+    }
+}
+
+void BitWriter::write_varint(std::uint32_t value)
+{
+    // value + 1 is written as its significant bits, MSB first, after one fewer zeros than that
+    auto coded = static_cast<std::uint64_t>(value) + 1;
+    auto leading_zeros = static_cast<int>(std::bit_width(coded)) - 1;
+
+    write(0, leading_zeros);
+    for (int bit = leading_zeros; bit >= 0; bit--)
+    {
+        write(static_cast<std::uint32_t>((coded >> bit) & 1), 1);
+    }
+}
+
+void BitWriter::flush()
+{
+    if (scratch_bits_ > 0)
+    {
+        write_byte(static_cast<std::uint8_t>(scratch_));
+        scratch_ = 0;
+        scratch_bits_ = 0;
+    }
+}
+
+std::size_t BitWriter::bit_count() const
+{
+    return bit_count_;
+}
+
+std::size_t BitWriter::byte_count() const
+{
+    return (bit_count_ + 7) / 8;
+}
+
+bool BitWriter::is_valid() const
+{
+    return valid_;
+}
+
+int BitWriter::varint_bits(std::uint32_t value)
+{
+    auto coded = static_cast<std::uint64_t>(value) + 1;
+    return 2 * static_cast<int>(std::bit_width(coded)) - 1;
+}
+
+void BitWriter::write_byte(std::uint8_t byte)
+{
+    if (byte_position_ >= capacity_)
+    {
+        valid_ = false;
+        return;
+    }
+    data_[byte_position_++] = byte;
+}
+
+BitReader::BitReader(const std::uint8_t* data, std::size_t size)
+    : data_(data)
+    , size_(size)
+{
+}
+
+std::uint32_t BitReader::read(int bits)
+{
+    if (bits > static_cast<int>(remaining_bits()))
+    {
+        valid_ = false;
+        bit_position_ = size_ * 8;
+        return 0;
+    }
+
+    // Copy out whole bytes at a time, rather than bit by bit
+    std::uint32_t value = 0;
+    int done = 0;
+    while (done < bits)
+    {
+        auto offset = static_cast<int>(bit_position_ % 8);
+        auto count = std::min(8 - offset, bits - done);
+        auto byte = static_cast<std::uint32_t>(data_[bit_position_ / 8] >> offset);
+
+        value |= (byte & ((1u << count) - 1)) << done;
+        done += count;
+        bit_position_ += count;
+    }
+    return value;
+}
+
+std::uint32_t BitReader::read_varint()
+{
+    int leading_zeros = 0;
+    while (read(1) == 0)
+    {
+        if (!valid_ || ++leading_zeros > 32)
+        {
+            valid_ = false;
+            return 0;
+        }
+    }
+
+    std::uint64_t coded = 1;
+    for (int i = 0; i < leading_zeros; i++)
+    {
+        coded = (coded << 1) | read(1);
+    }
+
+    // 32 zeros are needed for the largest value, but leave room for values that do not fit
+    if (coded - 1 > std::numeric_limits<std::uint32_t>::max())
+    {
+        valid_ = false;
+        return 0;
+    }
+    return static_cast<std::uint32_t>(coded - 1);
+}
+
+std::size_t BitReader::remaining_bits() const
+{
+    return size_ * 8 - bit_position_;
+}
+
+bool BitReader::is_valid() const
+{
+    return valid_;
+}
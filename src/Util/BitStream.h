@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// Writes values into a buffer using only as many bits as they need. Bits are packed LSB first, so
+/// the bytes are the same on any platform. The buffer is not owned, and is never grown - writing
+/// past its end writes nothing and marks the writer as invalid.
+class BitWriter
+{
+  public:
+    BitWriter() = default;
+    BitWriter(std::uint8_t* data, std::size_t capacity);
+
+    /// Writes the lowest `bits` bits of the value, up to 32 bits at a time
+    void write(std::uint32_t value, int bits);
+
+    /// Exp-Golomb code, so small values take few bits: 0 takes 1 bit, 1-2 take 3, 3-6 take 5
+    void write_varint(std::uint32_t value);
+
+    /// Writes out the final partial byte, padded with zeros. Call once done writing
+    void flush();
+
+    [[nodiscard]] std::size_t bit_count() const;
+
+    /// Number of bytes the bits written so far take up
+    [[nodiscard]] std::size_t byte_count() const;
+
+    [[nodiscard]] bool is_valid() const;
+
+    /// Number of bits write_varint takes to write the value
+    [[nodiscard]] static int varint_bits(std::uint32_t value);
+
+  private:
+    void write_byte(std::uint8_t byte);
+
+    std::uint8_t* data_ = nullptr;
+    std::size_t capacity_ = 0;
+    std::size_t byte_position_ = 0;
+
+    std::uint64_t scratch_ = 0;
+    int scratch_bits_ = 0;
+    std::size_t bit_count_ = 0;
+    bool valid_ = true;
+};
+
+/// Reads values written by a BitWriter directly from a buffer, which must outlive the reader.
+/// Reading past the end gives zeros, and marks the reader as invalid.
+class BitReader
+{
+  public:
+    BitReader() = default;
+    BitReader(const std::uint8_t* data, std::size_t size);
+
+    std::uint32_t read(int bits);
+    std::uint32_t read_varint();
+
+    [[nodiscard]] std::size_t remaining_bits() const;
+    [[nodiscard]] bool is_valid() const;
+
+  private:
+    const std::uint8_t* data_ = nullptr;
+    std::size_t size_ = 0;
+    std::size_t bit_position_ = 0;
+    bool valid_ = true;
+};
@@ -0,0 +1,138 @@
+#include "JobSystem.h"
+
+#include <algorithm>
+
+JobSystem::JobSystem(int worker_count)
+{
+    worker_count = std::max(worker_count, 0);
+    for (int i = 0; i < worker_count + 1; i++)
+    {
+        queues_.push_back(std::make_unique<JobQueue>());
+    }
+    for (int i = 0; i < worker_count; i++)
+    {
+        workers_.emplace_back([this, i] { worker_loop(i + 1); });
+    }
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard lock(sleep_mutex_);
+        stopping_ = true;
+    }
+    wake_workers_.notify_all();
+    workers_.clear();
+}
+
+int JobSystem::worker_count() const
+{
+    return static_cast<int>(workers_.size());
+}
+
+void JobSystem::run_parallel_for(int count, int grain, JobFunction function, void* context)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    grain = std::max(grain, 1);
+    if (workers_.empty() || count <= grain)
+    {
+        function(context, 0, count);
+        return;
+    }
+
+    std::atomic_int remaining = (count + grain - 1) / grain;
+    {
+        // Pushed in reverse, so the calling thread takes the ranges from the start while any
+        // stealing workers take them from the end
+        std::lock_guard lock(queues_[0]->mutex);
+        for (int begin = (remaining - 1) * grain; begin >= 0; begin -= grain)
+        {
+            queues_[0]->jobs.push_back({.function = function,
+                                        .context = context,
+                                        .begin = begin,
+                                        .end = std::min(begin + grain, count),
+                                        .remaining = &remaining});
+        }
+    }
+    {
+        std::lock_guard lock(sleep_mutex_);
+        queued_jobs_ += remaining;
+    }
+    wake_workers_.notify_all();
+
+    // Help out until every range is done, including those stolen by workers
+    Job job;
+    while (remaining > 0)
+    {
+        if (find_job(0, job))
+        {
+            run_job(job);
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void JobSystem::worker_loop(int queue_index)
+{
+    Job job;
+    while (true)
+    {
+        if (find_job(queue_index, job))
+        {
+            run_job(job);
+            continue;
+        }
+
+        std::unique_lock lock(sleep_mutex_);
+        wake_workers_.wait(lock, [this] { return stopping_ || queued_jobs_ > 0; });
+        if (stopping_)
+        {
+            return;
+        }
+    }
+}
+
+bool JobSystem::find_job(int queue_index, Job& job)
+{
+    auto queue_count = static_cast<int>(queues_.size());
+    for (int i = 0; i < queue_count; i++)
+    {
+        auto& queue = *queues_[(queue_index + i) % queue_count];
+        std::lock_guard lock(queue.mutex);
+        if (queue.jobs.empty())
+        {
+            continue;
+        }
+
+        if (i == 0)
+        {
+            job = queue.jobs.back();
+            queue.jobs.pop_back();
+        }
+        else
+        {
+            job = queue.jobs.front();
+            queue.jobs.pop_front();
+        }
+
+        // Counted under the sleep mutex, so a worker cannot check the count between it changing and
+        // the wake up being sent
+        std::lock_guard sleep_lock(sleep_mutex_);
+        queued_jobs_--;
+        return true;
+    }
+    return false;
+}
+
+void JobSystem::run_job(const Job& job)
+{
+    job.function(job.context, job.begin, job.end);
+    job.remaining->fetch_sub(1, std::memory_order_acq_rel);
+}
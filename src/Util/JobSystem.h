@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/// Work stealing thread pool.
+///
+/// Each thread has its own queue of jobs. A thread takes the newest job from its own queue, and when
+/// it runs out, steals the oldest job from another thread's queue. The thread calling parallel_for
+/// splits the work into jobs on its own queue, and works on them too until they are all done.
+class JobSystem
+{
+  public:
+    /// Starts `worker_count` threads, which are used along with the thread calling parallel_for.
+    /// With no workers, parallel_for just runs everything on the calling thread
+    explicit JobSystem(int worker_count);
+    ~JobSystem();
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    /// Calls `job(begin, end)` for ranges covering [0, count), each at most `grain` long, and
+    /// returns once they are all done. The ranges are run in parallel, so must not write to the
+    /// same data. Results do not depend on which thread runs which range.
+    template <typename Job>
+    void parallel_for(int count, int grain, Job&& job)
+    {
+        using JobType = std::remove_reference_t<Job>;
+        run_parallel_for(
+            count, grain,
+            [](void* context, int begin, int end) { (*static_cast<JobType*>(context))(begin, end); },
+            &job);
+    }
+
+    [[nodiscard]] int worker_count() const;
+
+  private:
+    using JobFunction = void (*)(void* context, int begin, int end);
+
+    struct Job
+    {
+        JobFunction function = nullptr;
+        void* context = nullptr;
+        int begin = 0;
+        int end = 0;
+
+        /// Counts down the jobs of the parallel_for this is a part of
+        std::atomic_int* remaining = nullptr;
+    };
+
+    struct JobQueue
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    void run_parallel_for(int count, int grain, JobFunction function, void* context);
+    void worker_loop(int queue_index);
+
+    /// Takes a job from the back of its own queue, or else the front of any other queue
+    bool find_job(int queue_index, Job& job);
+    void run_job(const Job& job);
+
+    /// Queue 0 belongs to the thread calling parallel_for, the rest to the workers
+    std::vector<std::unique_ptr<JobQueue>> queues_;
+    std::vector<std::jthread> workers_;
+
+    /// Workers sleep while there are no queued jobs. The count and the stop flag are only touched
+    /// with `sleep_mutex_` held
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_workers_;
+    int queued_jobs_ = 0;
+    bool stopping_ = false;
+};
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <utility>
+
+/// Size of a cache line. The indices written by each side of a queue are kept on their own line,
+/// so the producer and consumer do not make each other's cores reload them
+constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+/// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+///
+/// Each side keeps a copy of the other side's index, and only reloads it when the queue looks
+/// full or empty, so most pushes and pops touch no memory the other thread is writing.
+template <typename T>
+class SpscQueue
+{
+  public:
+    /// The capacity is rounded up to a power of two
+    explicit SpscQueue(std::size_t capacity)
+        : capacity_(std::bit_ceil(std::max<std::size_t>(capacity, 1)))
+        , slots_(std::make_unique<T[]>(capacity_))
+    {
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    /// Producer only. Returns false if the queue is full, in which case the value is not moved from
+    [[nodiscard]] bool try_push(T&& value)
+    {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        if (tail - cached_head_ == capacity_)
+        {
+            cached_head_ = head_.load(std::memory_order_acquire);
+            if (tail - cached_head_ == capacity_)
+            {
+                return false;
+            }
+        }
+        slots_[tail & (capacity_ - 1)] = std::move(value);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Consumer only. Returns nullopt if the queue is empty
+    [[nodiscard]] std::optional<T> try_pop()
+    {
+        auto head = head_.load(std::memory_order_relaxed);
+        if (head == cached_tail_)
+        {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head == cached_tail_)
+            {
+                return std::nullopt;
+            }
+        }
+        std::optional<T> value = std::move(slots_[head & (capacity_ - 1)]);
+        head_.store(head + 1, std::memory_order_release);
+        return value;
+    }
+
+  private:
+    const std::size_t capacity_;
+    const std::unique_ptr<T[]> slots_;
+
+    /// Written by the producer
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> tail_ = 0;
+    std::size_t cached_head_ = 0;
+
+    /// Written by the consumer
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> head_ = 0;
+    std::size_t cached_tail_ = 0;
+};
+
+/// Bounded lock-free queue for any number of producer threads and one consumer thread.
+///
+/// Each slot has a sequence number saying whether it is free to write for a given lap of the ring,
+/// or holds a value ready to read. Producers claim a slot by moving the tail on with a
+/// compare-exchange, so they only contend with each other for that one index.
+template <typename T>
+class MpscQueue
+{
+  public:
+    /// The capacity is rounded up to a power of two
+    explicit MpscQueue(std::size_t capacity)
+        : capacity_(std::bit_ceil(std::max<std::size_t>(capacity, 1)))
+        , slots_(std::make_unique<Slot[]>(capacity_))
+    {
+        for (std::size_t i = 0; i < capacity_; i++)
+        {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    /// Any thread. Returns false if the queue is full, in which case the value is not moved from
+    [[nodiscard]] bool try_push(T&& value)
+    {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        while (true)
+        {
+            auto& slot = slots_[tail & (capacity_ - 1)];
+            auto sequence = slot.sequence.load(std::memory_order_acquire);
+            auto lap = static_cast<std::ptrdiff_t>(sequence - tail);
+            if (lap == 0)
+            {
+                // On failure the tail is reloaded, and the slot after it is tried instead
+                if (tail_.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed))
+                {
+                    slot.value = std::move(value);
+                    slot.sequence.store(tail + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (lap < 0)
+            {
+                // The consumer has not yet read the value from the last lap
+                return false;
+            }
+            else
+            {
+                tail = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// Consumer only. Returns nullopt if the queue is empty, or the next value is still being
+    /// written
+    [[nodiscard]] std::optional<T> try_pop()
+    {
+        auto& slot = slots_[head_ & (capacity_ - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != head_ + 1)
+        {
+            return std::nullopt;
+        }
+        std::optional<T> value = std::move(slot.value);
+        slot.sequence.store(head_ + capacity_, std::memory_order_release);
+        head_++;
+        return value;
+    }
+
+  private:
+    struct Slot
+    {
+        std::atomic<std::size_t> sequence = 0;
+        T value{};
+    };
+
+    const std::size_t capacity_;
+    const std::unique_ptr<Slot[]> slots_;
+
+    /// Written by the producers
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> tail_ = 0;
+
+    /// Written by the consumer
+    alignas(CACHE_LINE_SIZE) std::size_t head_ = 0;
+};
@@ -0,0 +1,135 @@
+#include "MappedFile.h"
+
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : data_(std::exchange(other.data_, nullptr))
+    , size_(std::exchange(other.size_, 0))
+#ifdef _WIN32
+    , file_(std::exchange(other.file_, nullptr))
+    , mapping_(std::exchange(other.mapping_, nullptr))
+#endif
+{
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+#ifdef _WIN32
+        file_ = std::exchange(other.file_, nullptr);
+        mapping_ = std::exchange(other.mapping_, nullptr);
+#endif
+    }
+    return *this;
+}
+
+std::optional<MappedFile> MappedFile::open(const std::string& path)
+{
+    MappedFile file;
+
+#ifdef _WIN32
+    file.file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file.file_ == INVALID_HANDLE_VALUE)
+    {
+        file.file_ = nullptr;
+        return std::nullopt;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file.file_, &size) || size.QuadPart == 0)
+    {
+        return std::nullopt;
+    }
+
+    file.mapping_ = CreateFileMappingA(file.file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!file.mapping_)
+    {
+        return std::nullopt;
+    }
+
+    auto* data = MapViewOfFile(file.mapping_, FILE_MAP_READ, 0, 0, 0);
+    if (!data)
+    {
+        return std::nullopt;
+    }
+    file.data_ = static_cast<const std::uint8_t*>(data);
+    file.size_ = static_cast<std::size_t>(size.QuadPart);
+#else
+    auto descriptor = ::open(path.c_str(), O_RDONLY);
+    if (descriptor < 0)
+    {
+        return std::nullopt;
+    }
+
+    // The mapping stays valid once the descriptor is closed
+    struct stat status{};
+    void* data = MAP_FAILED;
+    if (fstat(descriptor, &status) == 0 && status.st_size > 0)
+    {
+        data = mmap(nullptr, static_cast<std::size_t>(status.st_size), PROT_READ, MAP_PRIVATE,
+                    descriptor, 0);
+    }
+    ::close(descriptor);
+    if (data == MAP_FAILED)
+    {
+        return std::nullopt;
+    }
+    file.data_ = static_cast<const std::uint8_t*>(data);
+    file.size_ = static_cast<std::size_t>(status.st_size);
+#endif
+
+    return file;
+}
+
+std::span<const std::uint8_t> MappedFile::data() const
+{
+    return {data_, size_};
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+    if (data_)
+    {
+        UnmapViewOfFile(data_);
+    }
+    if (mapping_)
+    {
+        CloseHandle(mapping_);
+    }
+    if (file_)
+    {
+        CloseHandle(file_);
+    }
+    file_ = nullptr;
+    mapping_ = nullptr;
+#else
+    if (data_)
+    {
+        munmap(const_cast<std::uint8_t*>(data_), size_);
+    }
+#endif
+    data_ = nullptr;
+    size_ = 0;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+
+/// A whole file mapped read only into memory. Nothing is read up front, the OS pages in the parts
+/// of the file as they are first touched.
+class MappedFile
+{
+  public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /// Returns nullopt if the file does not exist, is empty, or can not be mapped
+    [[nodiscard]] static std::optional<MappedFile> open(const std::string& path);
+
+    [[nodiscard]] std::span<const std::uint8_t> data() const;
+
+  private:
+    void close();
+
+    const std::uint8_t* data_ = nullptr;
+    std::size_t size_ = 0;
+
+#ifdef _WIN32
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+#endif
+};
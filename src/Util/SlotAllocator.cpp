@@ -0,0 +1,42 @@
+#include "SlotAllocator.h"
+
+#include <algorithm>
+
+SlotAllocator::SlotAllocator(int capacity)
+    : capacity_(std::max(capacity, 0))
+{
+    free_slots_.reserve(capacity_);
+    for (int slot = capacity_ - 1; slot >= 0; slot--)
+    {
+        free_slots_.push_back(slot);
+    }
+}
+
+std::optional<int> SlotAllocator::acquire()
+{
+    if (free_slots_.empty())
+    {
+        return {};
+    }
+    auto slot = free_slots_.back();
+    free_slots_.pop_back();
+    return slot;
+}
+
+void SlotAllocator::release(int slot)
+{
+    if (slot >= 0 && slot < capacity_)
+    {
+        free_slots_.push_back(slot);
+    }
+}
+
+int SlotAllocator::capacity() const
+{
+    return capacity_;
+}
+
+int SlotAllocator::in_use() const
+{
+    return capacity_ - static_cast<int>(free_slots_.size());
+}
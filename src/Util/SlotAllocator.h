@@ -0,0 +1,24 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+
+/// Hands out integer slots in the range [0, capacity) in O(1) using a free list.
+/// Lower slots are handed out first, and released slots are reused before untouched ones.
+class SlotAllocator
+{
+  public:
+    explicit SlotAllocator(int capacity);
+
+    /// Returns nullopt when all slots are in use
+    [[nodiscard]] std::optional<int> acquire();
+    void release(int slot);
+
+    [[nodiscard]] int capacity() const;
+    [[nodiscard]] int in_use() const;
+
+  private:
+    /// Used as a stack, the next slot to hand out is at the back
+    std::vector<int> free_slots_;
+    int capacity_ = 0;
+};
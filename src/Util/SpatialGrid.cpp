@@ -0,0 +1,69 @@
+#include "SpatialGrid.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+namespace
+{
+    /// Cell coordinates are clamped to this, so positions far outside of the world do not overflow
+    constexpr float MAX_CELL = 1 << 20;
+} // namespace
+
+SpatialGrid::SpatialGrid(float cell_size)
+    : cell_size_(cell_size)
+{
+}
+
+void SpatialGrid::build(std::span<const SpatialGridEntry> entries)
+{
+    // Twice as many buckets as entries keeps the number of cells that share a bucket low
+    auto bucket_count = std::bit_ceil(std::max<std::size_t>(entries.size() * 2, 1));
+    bucket_mask_ = bucket_count - 1;
+
+    // Count the entries of each bucket, offset by one so the prefix sum gives the start of each
+    bucket_starts_.assign(bucket_count + 1, 0);
+    entry_buckets_.resize(entries.size());
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        auto position = entries[i].position;
+        entry_buckets_[i] = bucket(cell(position.x), cell(position.y));
+        bucket_starts_[entry_buckets_[i] + 1]++;
+    }
+    for (size_t i = 1; i < bucket_starts_.size(); i++)
+    {
+        bucket_starts_[i] += bucket_starts_[i - 1];
+    }
+
+    // Place each entry at the next free index of its bucket
+    next_index_.assign(bucket_starts_.begin(), bucket_starts_.end());
+    entries_.resize(entries.size());
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        auto position = entries[i].position;
+        entries_[next_index_[entry_buckets_[i]]++] = {
+            .entry = entries[i], .cell_x = cell(position.x), .cell_y = cell(position.y)};
+    }
+}
+
+void SpatialGrid::query_radius(sf::Vector2f centre, float radius, std::vector<int>& ids) const
+{
+    visit_radius(centre, radius,
+                 [&](const SpatialGridEntry& entry)
+                 {
+                     ids.push_back(entry.id);
+                     return true;
+                 });
+}
+
+int SpatialGrid::cell(float position) const
+{
+    return static_cast<int>(std::clamp(std::floor(position / cell_size_), -MAX_CELL, MAX_CELL));
+}
+
+std::size_t SpatialGrid::bucket(int cell_x, int cell_y) const
+{
+    auto hash = static_cast<std::size_t>(static_cast<unsigned>(cell_x) * 73856093u ^
+                                         static_cast<unsigned>(cell_y) * 19349663u);
+    return hash & bucket_mask_;
+}
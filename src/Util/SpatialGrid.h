@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#include <SFML/System/Vector2.hpp>
+
+struct SpatialGridEntry
+{
+    int id = 0;
+    sf::Vector2f position;
+};
+
+/// Uniform grid that buckets ids by position, so the ids near a point can be found without checking
+/// every entity. It is rebuilt from scratch each time rather than updated as entities move.
+///
+/// The cells are hashed into a table sized by the number of entries, rather than stored for the
+/// whole world, so the memory used and time to build do not depend on how big the world is.
+class SpatialGrid
+{
+  public:
+    explicit SpatialGrid(float cell_size);
+
+    /// Buckets the entries with a counting sort, so the ids of each bucket are stored together
+    void build(std::span<const SpatialGridEntry> entries);
+
+    /// Appends the ids of the entries within the radius of the centre to `ids`, in no set order
+    void query_radius(sf::Vector2f centre, float radius, std::vector<int>& ids) const;
+
+    /// Calls `visit` with each entry within the radius of the centre, in no set order, until it
+    /// returns false. Lets the caller stop once it has found enough of the entries it wants
+    template <typename Visit>
+    void visit_radius(sf::Vector2f centre, float radius, Visit&& visit) const
+    {
+        auto radius_squared = radius * radius;
+        visit_cells(cell(centre.x - radius), cell(centre.y - radius), cell(centre.x + radius),
+                    cell(centre.y + radius),
+                    [&](const SpatialGridEntry& entry)
+                    {
+                        auto diff = entry.position - centre;
+                        return diff.x * diff.x + diff.y * diff.y > radius_squared || visit(entry);
+                    });
+    }
+
+  private:
+    struct Entry
+    {
+        SpatialGridEntry entry;
+
+        /// Cells that hash to the same bucket are told apart by these
+        int cell_x = 0;
+        int cell_y = 0;
+    };
+
+    /// Calls `visit` with each entry in the cells from (min_x, min_y) to (max_x, max_y), until it
+    /// returns false. The entries are checked directly once that is quicker than each cell
+    template <typename Visit>
+    void visit_cells(int min_x, int min_y, int max_x, int max_y, Visit&& visit) const
+    {
+        // Looking up each cell costs more than checking each entry once the area covers more cells
+        // than there are entries
+        auto cell_count = static_cast<double>(max_x - min_x + 1) * (max_y - min_y + 1);
+        if (cell_count > static_cast<double>(entries_.size()))
+        {
+            for (const auto& entry : entries_)
+            {
+                if (!visit(entry.entry))
+                {
+                    return;
+                }
+            }
+            return;
+        }
+
+        for (int y = min_y; y <= max_y; y++)
+        {
+            for (int x = min_x; x <= max_x; x++)
+            {
+                auto index = bucket(x, y);
+                for (int i = bucket_starts_[index]; i < bucket_starts_[index + 1]; i++)
+                {
+                    const auto& entry = entries_[i];
+                    if (entry.cell_x == x && entry.cell_y == y && !visit(entry.entry))
+                    {
+                        return;
+                    }
+                }
+            }
+        }
+    }
+
+    [[nodiscard]] int cell(float position) const;
+    [[nodiscard]] std::size_t bucket(int cell_x, int cell_y) const;
+
+    float cell_size_ = 1;
+
+    /// The bucket count is a power of two, so this masks a hash into a bucket
+    std::size_t bucket_mask_ = 0;
+
+    /// The entries of bucket `i` are `entries_[bucket_starts_[i]]` up to
+    /// `entries_[bucket_starts_[i + 1]]`
+    std::vector<int> bucket_starts_;
+    std::vector<Entry> entries_;
+
+    /// Scratch space for build(), kept so that rebuilding each tick does not allocate
+    std::vector<std::size_t> entry_buckets_;
+    std::vector<int> next_index_;
+};
@@ -0,0 +1,70 @@
+#include "TimeStep.h"
+
+#include <algorithm>
+#include <thread>
+
+TimeStep::TimeStep(float ticks_per_second, int max_catch_up_ticks)
+    : period_(std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(1.0 / ticks_per_second)))
+    , last_time_(Clock::now())
+    , max_catch_up_ticks_(std::max(max_catch_up_ticks, 1))
+{
+}
+
+int TimeStep::wait_for_ticks()
+{
+    auto now = Clock::now();
+    accumulator_ += now - last_time_;
+    last_time_ = now;
+
+    // Sleep until the deadline of the next tick, rather than for a whole period. This is a loop as
+    // sleep_until can wake up a touch early
+    while (accumulator_ < period_)
+    {
+        std::this_thread::sleep_until(now + (period_ - accumulator_));
+
+        now = Clock::now();
+        accumulator_ += now - last_time_;
+        last_time_ = now;
+    }
+
+    auto ticks = static_cast<std::uint64_t>(accumulator_ / period_);
+    accumulator_ -= period_ * ticks;
+
+    // Too far behind, drop the ticks rather than trying to catch up on all of them
+    if (ticks > static_cast<std::uint64_t>(max_catch_up_ticks_))
+    {
+        stats_.skipped_ticks += ticks - max_catch_up_ticks_;
+        ticks = max_catch_up_ticks_;
+    }
+
+    ticks_due_ = static_cast<int>(ticks);
+    work_start_ = now;
+    return ticks_due_;
+}
+
+void TimeStep::end_ticks()
+{
+    auto work_time =
+        std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - work_start_);
+
+    stats_.ticks += ticks_due_;
+    stats_.total_work_time += work_time;
+    stats_.longest_work_time = std::max(stats_.longest_work_time, work_time);
+    // Catching up runs several ticks back to back, which is only an overrun if they take longer
+    // than that many periods
+    if (work_time > period_ * ticks_due_)
+    {
+        stats_.overruns++;
+    }
+}
+
+TimeStep::Clock::duration TimeStep::period() const
+{
+    return period_;
+}
+
+const TimeStepStats& TimeStep::stats() const
+{
+    return stats_;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+/// Overrun accounting for a TimeStep, used to see when the server cannot keep up with its tick rate
+struct TimeStepStats
+{
+    /// Number of ticks that have been run
+    std::uint64_t ticks = 0;
+
+    /// Number of times the work for the ticks that were due took longer than that many periods
+    std::uint64_t overruns = 0;
+
+    /// Number of ticks that were dropped because the catch-up limit was hit
+    std::uint64_t skipped_ticks = 0;
+
+    std::chrono::microseconds total_work_time{0};
+    std::chrono::microseconds longest_work_time{0};
+};
+
+/// Deadline based fixed time step.
+///
+/// Elapsed time from a monotonic clock is added to an accumulator, and a tick is due every time the
+/// accumulator holds a full period. Sleeping is done until the next deadline rather than for a flat
+/// period, so the time spent doing the work of a tick does not push the following ticks back.
+///
+/// If the work falls behind (eg a very long tick), up to `max_catch_up_ticks` ticks are run back to
+/// back to catch up, and any further ticks are dropped so the server does not spiral.
+class TimeStep
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    TimeStep(float ticks_per_second, int max_catch_up_ticks);
+
+    /// Sleeps until the next tick is due, and returns how many ticks should be run (always >= 1)
+    [[nodiscard]] int wait_for_ticks();
+
+    /// Records the time the work took since wait_for_ticks returned, for overrun accounting
+    void end_ticks();
+
+    [[nodiscard]] Clock::duration period() const;
+    [[nodiscard]] const TimeStepStats& stats() const;
+
+  private:
+    Clock::duration period_;
+    Clock::duration accumulator_{0};
+    Clock::time_point last_time_;
+    Clock::time_point work_start_;
+
+    int max_catch_up_ticks_ = 1;
+    int ticks_due_ = 0;
+
+    TimeStepStats stats_;
+};
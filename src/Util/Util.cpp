@@ -50,6 +50,21 @@ void load_texture(sf::Texture& texture, const std::filesystem::path& file_path)
     }
 }
 
+void append_quad(sf::VertexArray& vertices, sf::Vector2f position, sf::Vector2f size,
+                 sf::Color colour, sf::FloatRect texture_rect)
+{
+    std::array<sf::Vector2f, 4> corners = {position, position + sf::Vector2f{size.x, 0},
+                                           position + sf::Vector2f{0, size.y}, position + size};
+    const auto& [uv_position, uv_size] = texture_rect;
+    std::array<sf::Vector2f, 4> uvs = {uv_position, uv_position + sf::Vector2f{uv_size.x, 0},
+                                       uv_position + sf::Vector2f{0, uv_size.y},
+                                       uv_position + uv_size};
+    for (auto corner : {0, 1, 2, 2, 1, 3})
+    {
+        vertices.append({.position = corners[corner], .color = colour, .texCoords = uvs[corner]});
+    }
+}
+
 std::string read_file_to_string(const std::filesystem::path& file_path)
 {
     std::ifstream in_file(file_path);
@@ -5,7 +5,9 @@
 #include <string_view>
 #include <vector>
 
+#include <SFML/Graphics/Rect.hpp>
 #include <SFML/Graphics/Texture.hpp>
+#include <SFML/Graphics/VertexArray.hpp>
 #include <SFML/System/Vector2.hpp>
 
 template <typename T>
@@ -17,5 +19,10 @@ std::ostream& operator<<(std::ostream& stream, const sf::Vector2<T>& vector)
 
 void load_texture(sf::Texture& texture, const std::filesystem::path& file_path);
 
+/// Adds a rectangle as two triangles to a vertex array of sf::PrimitiveType::Triangles, so any
+/// number of rectangles can be drawn with one call. The texture rectangle is in pixels
+void append_quad(sf::VertexArray& vertices, sf::Vector2f position, sf::Vector2f size,
+                 sf::Color colour, sf::FloatRect texture_rect = {});
+
 [[nodiscard]] std::string read_file_to_string(const std::filesystem::path& file_path);
 [[nodiscard]] std::vector<std::string> split_string(const std::string& string, char delim = ' ');
\ No newline at end of file